@@ -18,14 +18,19 @@
 #include "icon.h"
 #include "layout.h"
 #include "misc.h"
+#include "prop.h"
 
-static void apply_rules(WM *wm, Client *c);
+static void apply_rules(WM *wm, Client *c, const Client_props *props);
 static bool have_rule(Rule *r, Client *c);
 static void set_default_pos(WM *wm, Client *c, XWindowAttributes *a);
 static void set_default_size(WM *wm, Client *c, XWindowAttributes *a);
 static void frame_client(WM *wm, Client *c);
 static Rect get_button_rect(Client *c, size_t index);
+static unsigned int get_title_buttons_n(WM *wm);
+static void draw_title_buttons(WM *wm, Client *c, bool is_focused, unsigned int n);
 static Rect get_frame_rect(Client *c);
+static bool update_rect_cache(WM *wm, Rect *cache, Rect r, unsigned int req_n);
+static void del_title_pixmap(WM *wm, Client *c);
 static void update_focus_client_pointer(WM *wm, unsigned int desktop_n, Client *c);
 static bool is_exist_client(WM *wm, Client *c);
 static Client *get_next_map_client(WM *wm, unsigned int desktop_n, Client *c);
@@ -35,16 +40,21 @@ static bool move_client_node(WM *wm, Client *from, Client *to, Area_type type);
 
 void add_client(WM *wm, Window win)
 {
+    Client_props props;
     Client *c=malloc_s(sizeof(Client));
     memset(c, 0, sizeof(Client));
     c->win=win;
-    c->owner=get_transient_for(wm, win);
-    c->title_text=get_text_prop(wm, win, XA_WM_NAME);
-    update_size_hint(wm, c);
-    apply_rules(wm, c);
+    set_win_index(wm, win, c, CLIENT_WIN);
+    get_client_props(wm, win, &props);
+    c->owner=props.owner;
+    c->title_text=props.title_text;
+    c->wm_hint=props.wm_hint;
+    set_size_hint(c, props.has_size_hint ? &props.size_hint : NULL);
+    apply_rules(wm, c, &props);
     add_client_node(get_area_head(wm, c->area_type), c);
     fix_area_type(wm);
-    set_default_rect(wm, c);
+    set_default_size(wm, c, &props.attr);
+    set_default_pos(wm, c, &props.attr);
     frame_client(wm, c);
     if(c->area_type == ICONIFY_AREA)
         iconify(wm, c);
@@ -54,23 +64,21 @@ void add_client(WM *wm, Window win)
     XSelectInput(wm->display, win, EnterWindowMask|PropertyChangeMask);
 }
 
-static void apply_rules(WM *wm, Client *c)
+static void apply_rules(WM *wm, Client *c, const Client_props *props)
 {
-    Atom type=get_atom_prop(wm, c->win, wm->ewmh_atom[_NET_WM_WINDOW_TYPE]),
-         state=get_atom_prop(wm, c->win, wm->ewmh_atom[_NET_WM_STATE]);
-
-    Window tw=get_transient_for(wm, c->win);
+    Window tw=c->owner;
     c->area_type=DESKTOP(wm).default_area_type;
     if( (tw && tw!=wm->root_win)
-        || type != wm->ewmh_atom[_NET_WM_WINDOW_TYPE_NORMAL]
-        || state == wm->ewmh_atom[_NET_WM_STATE_MODAL])
+        || props->type != wm->ewmh_atom[_NET_WM_WINDOW_TYPE_NORMAL]
+        || props->state == wm->ewmh_atom[_NET_WM_STATE_MODAL])
         c->area_type=FLOATING_AREA;
     c->border_w=BORDER_WIDTH;
     c->title_bar_h=TITLE_BAR_HEIGHT;
     c->desktop_mask=get_desktop_mask(wm->cur_desktop);
     c->class_hint.res_class=c->class_hint.res_name=NULL, c->class_name="?";
-    if(XGetClassHint(wm->display, c->win, &c->class_hint))
+    if(props->has_class_hint)
     {
+        c->class_hint=props->class_hint;
         Rule *r=RULE;
         c->class_name=c->class_hint.res_class;
         for(size_t i=0; i<ARRAY_NUM(RULE); i++, r++)
@@ -141,7 +149,7 @@ static void set_default_pos(WM *wm, Client *c, XWindowAttributes *a)
          sw=wm->screen_width, sh=wm->screen_height, th=wm->taskbar.h;
     if(!(p->flags & PPosition))
         c->x=a->x, c->y=a->y;
-    if((oc=win_to_client(wm, get_transient_for(wm, c->win))))
+    if((oc=win_to_client(wm, c->owner)))
         ow=oc->w, oh=oc->h, c->x=oc->x+(ow-w)/2, c->y=oc->y+(oh-h)/2;
     if(c->x >= sw-w-bw)
         c->x=sw-w-bw;
@@ -185,7 +193,9 @@ static void frame_client(WM *wm, Client *c)
     Rect fr=get_frame_rect(c);
     c->frame=XCreateSimpleWindow(wm->display, wm->root_win, fr.x, fr.y, fr.w,
         fr.h, c->border_w, wm->widget_color[CURRENT_BORDER_COLOR].pixel, 0);
+    c->frame_rect=fr;
     XSelectInput(wm->display, c->frame, FRAME_EVENT_MASK);
+    set_win_index(wm, c->frame, c, CLIENT_FRAME);
 #if SET_FRAME_PROP
     update_frame_prop(wm, c);
 #endif
@@ -216,21 +226,140 @@ void update_frame_prop(WM *wm, Client *c)
     }
 }
 
+/* 單窗口標題欄模式下不創建標題按鈕窗口，c->buttons均保持爲0 */
 void create_title_bar(WM *wm, Client *c)
 {
-    unsigned long bc=wm->widget_color[CURRENT_TITLE_BUTTON_COLOR].pixel,
-                  ac=wm->widget_color[CURRENT_TITLE_AREA_COLOR].pixel;
+    unsigned long ac=wm->widget_color[CURRENT_TITLE_AREA_COLOR].pixel;
     Rect tr=get_title_area_rect(wm, c);
+#if !SINGLE_WIN_TITLE_BAR
+    unsigned long bc=wm->widget_color[CURRENT_TITLE_BUTTON_COLOR].pixel;
     for(size_t i=0; i<TITLE_BUTTON_N; i++)
     {
         Rect br=get_button_rect(c, i);
         c->buttons[i]=XCreateSimpleWindow(wm->display, c->frame,
             br.x, br.y, br.w, br.h, 0, 0, bc);
         XSelectInput(wm->display, c->buttons[i], BUTTON_EVENT_MASK);
+        set_win_index(wm, c->buttons[i], c, TITLE_BUTTON_BEGIN+i);
+        update_label_widget(wm, c->buttons[i], TITLE_BUTTON_BEGIN+i,
+            CURRENT_TITLE_BUTTON_COLOR);
     }
+#endif
     c->title_area=XCreateSimpleWindow(wm->display, c->frame,
         tr.x, tr.y, tr.w, tr.h, 0, 0, ac);
+    c->title_area_rect=tr, c->button_rect=get_button_rect(c, 0);
+    c->title_hover=TITLE_AREA;
     XSelectInput(wm->display, c->title_area, TITLE_AREA_EVENT_MASK);
+    set_win_index(wm, c->title_area, c, TITLE_AREA);
+    update_title_area(wm, c, true, true);
+}
+
+/* 把標題區的背景色和標題文字繪制到像素圖中並設爲標題區窗口的背景，由X
+ * 服務器自行重繪顯露的部分。僅在標題文字、聚焦狀態或寬度變化時才重繪，
+ * 標題文字變化時應把is_text_changed設爲true。單窗口標題欄模式下，標題
+ * 按鈕及其懸停效果也繪制在該像素圖中。 */
+void update_title_area(WM *wm, Client *c, bool is_focused, bool is_text_changed)
+{
+    Rect r=get_title_area_rect(wm, c);
+    unsigned int n=SINGLE_WIN_TITLE_BAR ? get_title_buttons_n(wm) : 0;
+    if(!c->title_bar_h || !r.w || r.w>c->w || TITLE_BUTTON_WIDTH*n>r.w)
+        return;
+    if( c->title_pixmap && !is_text_changed && r.w==c->title_pixmap_w
+        && is_focused==c->is_title_pixmap_focused
+        && n==c->title_pixmap_buttons_n
+        && c->title_hover==c->title_pixmap_hover)
+        return;
+
+    if(c->title_pixmap && r.w!=c->title_pixmap_w)
+        del_title_pixmap(wm, c);
+    if(!c->title_pixmap)
+        c->title_pixmap=XCreatePixmap(wm->display, c->title_area, r.w, r.h,
+            DefaultDepth(wm->display, wm->screen));
+    c->title_pixmap_w=r.w, c->is_title_pixmap_focused=is_focused;
+    c->title_pixmap_buttons_n=n, c->title_pixmap_hover=c->title_hover;
+
+    String_format f={{r.x, r.y, r.w-TITLE_BUTTON_WIDTH*n, r.h}, CENTER_LEFT,
+        true, is_focused ? wm->widget_color[CURRENT_TITLE_AREA_COLOR].pixel :
+        wm->widget_color[NORMAL_TITLE_AREA_COLOR].pixel,
+        wm->text_color[TITLE_AREA_TEXT_COLOR], TITLE_AREA_FONT};
+    draw_string(wm, c->title_pixmap, c->title_text, &f);
+    if(n)
+        draw_title_buttons(wm, c, is_focused, n);
+    update_win_background(wm, c->title_area, 0, c->title_pixmap);
+}
+
+/* 在標題區像素圖的右側復制當前布局下可見的n個標題按鈕的標籤像素圖 */
+static void draw_title_buttons(WM *wm, Client *c, bool is_focused, unsigned int n)
+{
+    XSetForeground(wm->display, wm->gc, is_focused ?
+        wm->widget_color[CURRENT_TITLE_AREA_COLOR].pixel :
+        wm->widget_color[NORMAL_TITLE_AREA_COLOR].pixel);
+    XFillRectangle(wm->display, c->title_pixmap, wm->gc,
+        c->w-TITLE_BUTTON_WIDTH*n, 0, TITLE_BUTTON_WIDTH*n, c->title_bar_h);
+    for(size_t i=TITLE_BUTTON_N-n; i<TITLE_BUTTON_N; i++)
+    {
+        Widget_type type=TITLE_BUTTON_BEGIN+i;
+        Widget_color color;
+        Rect r=get_button_rect(c, i);
+        if(type == c->title_hover)
+            color=(type==CLOSE_BUTTON ?
+                ENTERED_CLOSE_BUTTON_COLOR : ENTERED_NORMAL_BUTTON_COLOR);
+        else
+            color=(is_focused ?
+                CURRENT_TITLE_BUTTON_COLOR : NORMAL_TITLE_BUTTON_COLOR);
+        XCopyArea(wm->display, get_widget_label_pixmap(wm, type, color),
+            c->title_pixmap, wm->gc, 0, 0, r.w, r.h, r.x, r.y);
+    }
+}
+
+/* 單窗口標題欄模式下，根據標題區窗口內的坐標(x, y)判斷所在的標題欄構件 */
+Widget_type get_title_bar_widget_type(WM *wm, Client *c, int x, int y)
+{
+    for(size_t i=TITLE_BUTTON_N-get_title_buttons_n(wm); i<TITLE_BUTTON_N; i++)
+    {
+        Rect r=get_button_rect(c, i);
+        if(x>=r.x && x<r.x+(int)r.w && y>=r.y && y<r.y+(int)r.h)
+            return TITLE_BUTTON_BEGIN+i;
+    }
+    return TITLE_AREA;
+}
+
+/* 單窗口標題欄模式下，更新定位器所在的標題欄構件，並按需重繪懸停效果 */
+void update_title_hover(WM *wm, Client *c, Widget_type hover)
+{
+    if(c->title_hover != hover)
+    {
+        c->title_hover=hover;
+        update_title_area(wm, c, c->is_title_pixmap_focused, false);
+    }
+}
+
+static void del_title_pixmap(WM *wm, Client *c)
+{
+    if(c->title_pixmap)
+    {
+        del_xft_draw(wm, c->title_pixmap);
+        XFreePixmap(wm->display, c->title_pixmap);
+        c->title_pixmap=None;
+    }
+}
+
+void del_title_bar(WM *wm, Client *c)
+{
+    for(size_t i=0; i<TITLE_BUTTON_N; i++)
+    {
+        if(c->buttons[i])
+        {
+            del_win_index(wm, c->buttons[i]);
+            del_xft_draw(wm, c->buttons[i]);
+            XDestroyWindow(wm->display, c->buttons[i]);
+            c->buttons[i]=0;
+        }
+    }
+    del_win_index(wm, c->title_area);
+    del_xft_draw(wm, c->title_area);
+    XDestroyWindow(wm->display, c->title_area);
+    c->title_area=0;
+    del_title_pixmap(wm, c);
 }
 
 static Rect get_frame_rect(Client *c)
@@ -239,13 +368,20 @@ static Rect get_frame_rect(Client *c)
         c->w, c->h+c->title_bar_h};
 }
 
+/* 單窗口標題欄模式下，標題區窗口佔據整個標題欄 */
 Rect get_title_area_rect(WM *wm, Client *c)
 {
-    int buttons_n[]={[FULL]=0, [PREVIEW]=1, [STACK]=3, [TILE]=7},
-        n=buttons_n[DESKTOP(wm).cur_layout];
+    unsigned int n=SINGLE_WIN_TITLE_BAR ? 0 : get_title_buttons_n(wm);
     return (Rect){0, 0, c->w-TITLE_BUTTON_WIDTH*n, c->title_bar_h};
 }
 
+/* 返回當前布局下可見的標題按鈕數量，它們總是最右邊的幾個 */
+static unsigned int get_title_buttons_n(WM *wm)
+{
+    unsigned int buttons_n[]={[FULL]=0, [PREVIEW]=1, [STACK]=3, [TILE]=7};
+    return buttons_n[DESKTOP(wm).cur_layout];
+}
+
 static Rect get_button_rect(Client *c, size_t index)
 {
     return (Rect){c->w-TITLE_BUTTON_WIDTH*(TITLE_BUTTON_N-index),
@@ -264,17 +400,9 @@ unsigned int get_typed_clients_n(WM *wm, Area_type type)
 
 Client *win_to_client(WM *wm, Window win)
 {
-    // 當隱藏標題欄時，標題區和按鈕的窗口ID爲0。故win爲0時，不應視爲找到
-    for(Client *c=wm->clients->next; win && c!=wm->clients; c=c->next)
-    {
-        if(win==c->win || win==c->frame || win==c->title_area)
-            return c;
-        for(size_t i=0; i<TITLE_BUTTON_N; i++)
-            if(win == c->buttons[i])
-                return c;
-    }
-        
-    return NULL;
+    Client *c;
+    Widget_type type;
+    return find_win_index(wm, win, &c, &type) && type!=CLIENT_ICON ? c : NULL;
 }
 
 void del_client(WM *wm, Client *c, bool change_focus)
@@ -283,6 +411,14 @@ void del_client(WM *wm, Client *c, bool change_focus)
     {
         if(is_win_exist(wm, c->win, c->frame))
             XReparentWindow(wm->display, c->win, wm->root_win, c->x, c->y);
+        del_win_index(wm, c->win);
+        del_win_index(wm, c->frame);
+        del_win_index(wm, c->title_area);
+        del_xft_draw(wm, c->title_area);
+        del_title_pixmap(wm, c);
+        for(size_t i=0; i<TITLE_BUTTON_N; i++)
+            if(c->buttons[i])
+                del_win_index(wm, c->buttons[i]), del_xft_draw(wm, c->buttons[i]);
         XDestroyWindow(wm->display, c->frame);
         /* XDestroyWindow可能觸發EnterNotify事件，但此時frame已經銷毀了，
            因而會觸發X錯誤事件，應忽略這些錯誤事件。 */
@@ -296,14 +432,10 @@ void del_client(WM *wm, Client *c, bool change_focus)
                 if(is_on_desktop_n(i, c))
                     focus_client(wm, i, NULL);
 #if USE_IMAGE_ICON
-        if(c->image)
-        {
-            imlib_context_set_image(c->image);
-            imlib_free_image();
-        }
+        release_icon_image(wm, c->icon_image);
 #endif
-        XFree(c->class_hint.res_class);
-        XFree(c->class_hint.res_name);
+        free(c->class_hint.res_class);
+        free(c->class_hint.res_name);
         XFree(c->wm_hint);
         free(c->title_text);
         free(c);
@@ -316,23 +448,65 @@ void del_client_node(Client *c)
     c->next->prev=c->prev;
 }
 
+/* 只向X服務器發送幾何信息確有變化的窗口的配置請求 */
 void move_resize_client(WM *wm, Client *c, const Delta_rect *d)
 {
     if(d)
         c->x+=d->dx, c->y+=d->dy, c->w+=d->dw, c->h+=d->dh;
-    Rect fr=get_frame_rect(c), tr=get_title_area_rect(wm, c);
-    XMoveResizeWindow(wm->display, c->win,
-        0, c->title_bar_h, c->w, c->h);
+    Rect wr={0, c->title_bar_h, c->w, c->h}, fr=get_frame_rect(c),
+         tr=get_title_area_rect(wm, c), br=get_button_rect(c, 0);
+    bool win_changed=update_rect_cache(wm, &c->win_rect, wr, 1);
+    if(win_changed)
+        XMoveResizeWindow(wm->display, c->win, wr.x, wr.y, wr.w, wr.h);
     if(c->title_bar_h)
     {
-        for(size_t i=0; i<TITLE_BUTTON_N; i++)
+        if( !SINGLE_WIN_TITLE_BAR
+            && update_rect_cache(wm, &c->button_rect, br, TITLE_BUTTON_N))
+        {
+            for(size_t i=0; i<TITLE_BUTTON_N; i++)
+            {
+                br=get_button_rect(c, i);
+                XMoveWindow(wm->display, c->buttons[i], br.x, br.y);
+            }
+        }
+        if(update_rect_cache(wm, &c->title_area_rect, tr, 1))
         {
-            Rect br=get_button_rect(c, i);
-            XMoveWindow(wm->display, c->buttons[i], br.x, br.y);
+            XResizeWindow(wm->display, c->title_area, tr.w, tr.h);
+            update_title_area(wm, c, c->is_title_pixmap_focused, false);
         }
-        XResizeWindow(wm->display, c->title_area, tr.w, tr.h);
+        else if(SINGLE_WIN_TITLE_BAR) // 布局變化時可見的標題按鈕數量可能改變
+            update_title_area(wm, c, c->is_title_pixmap_focused, false);
     }
-    XMoveResizeWindow(wm->display, c->frame, fr.x, fr.y, fr.w, fr.h);
+    if(update_rect_cache(wm, &c->frame_rect, fr, 1))
+    {
+        XMoveResizeWindow(wm->display, c->frame, fr.x, fr.y, fr.w, fr.h);
+        if(!win_changed) // 按ICCCM的要求，只移動框架時須通知客戶窗口
+            config_managed_client(wm, c);
+    }
+}
+
+/* 若r與緩存相同，則表示相應的req_n個配置請求可以省去，返回false；否則更新
+ * 緩存並返回true */
+static bool update_rect_cache(WM *wm, Rect *cache, Rect r, unsigned int req_n)
+{
+    if(cache->x==r.x && cache->y==r.y && cache->w==r.w && cache->h==r.h)
+    {
+        wm->perf_stat.skipped_geometry_requests+=req_n;
+        return false;
+    }
+    *cache=r;
+    return true;
+}
+
+void config_managed_client(WM *wm, Client *c)
+{
+    XConfigureEvent ce=
+    {
+        .type=ConfigureNotify, .display=wm->display, .event=c->win,
+        .window=c->win, .x=c->x, .y=c->y, .width=c->w, .height=c->h,
+        .border_width=0, .above=None, .override_redirect=False
+    };
+    XSendEvent(wm->display, c->win, False, StructureNotifyMask, (XEvent *)&ce);
 }
 
 void update_frame(WM *wm, unsigned int desktop_n, Client *c)
@@ -344,22 +518,18 @@ void update_frame(WM *wm, unsigned int desktop_n, Client *c)
             wm->widget_color[NORMAL_BORDER_COLOR].pixel);
     if(c->title_bar_h)
     {
-        update_win_background(wm, c->title_area, flag ?
-            wm->widget_color[CURRENT_TITLE_AREA_COLOR].pixel :
-            wm->widget_color[NORMAL_TITLE_AREA_COLOR].pixel, None);
-        for(size_t i=0; i<TITLE_BUTTON_N; i++)
-            update_win_background(wm, c->buttons[i], flag ?
-                wm->widget_color[CURRENT_TITLE_BUTTON_COLOR].pixel :
-                wm->widget_color[NORMAL_TITLE_BUTTON_COLOR].pixel, None);
+        update_title_area(wm, c, flag, false);
+        for(size_t i=0; i<TITLE_BUTTON_N && c->buttons[i]; i++)
+            update_label_widget(wm, c->buttons[i], TITLE_BUTTON_BEGIN+i,
+                flag ? CURRENT_TITLE_BUTTON_COLOR : NORMAL_TITLE_BUTTON_COLOR);
     }
 }
 
 Client *win_to_iconic_state_client(WM *wm, Window win)
 {
-    for(Client *c=wm->clients->next; c!=wm->clients; c=c->next)
-        if(c->area_type==ICONIFY_AREA && c->icon->win==win)
-            return c;
-    return NULL;
+    Client *c;
+    Widget_type type;
+    return find_win_index(wm, win, &c, &type) && type==CLIENT_ICON ? c : NULL;
 }
 
 void focus_client(WM *wm, unsigned int desktop_n, Client *c)
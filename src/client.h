@@ -18,12 +18,17 @@ void fix_area_type(WM *wm);
 void set_default_rect(WM *wm, Client *c);
 void update_frame_prop(WM *wm, Client *c);
 void create_title_bar(WM *wm, Client *c);
+void update_title_area(WM *wm, Client *c, bool is_focused, bool is_text_changed);
+void del_title_bar(WM *wm, Client *c);
 Rect get_title_area_rect(WM *wm, Client *c);
+Widget_type get_title_bar_widget_type(WM *wm, Client *c, int x, int y);
+void update_title_hover(WM *wm, Client *c, Widget_type hover);
 unsigned int get_typed_clients_n(WM *wm, Area_type type);
 Client *win_to_client(WM *wm, Window win);
 void del_client(WM *wm, Client *c, bool change_focus);
 void del_client_node(Client *c);
 void move_resize_client(WM *wm, Client *c, const Delta_rect *d);
+void config_managed_client(WM *wm, Client *c);
 void update_frame(WM *wm, unsigned int desktop_n, Client *c);
 Client *win_to_iconic_state_client(WM *wm, Window win);
 void focus_client(WM *wm, unsigned int desktop_n, Client *c);
@@ -46,6 +46,9 @@
 #define AUTOSTART "~/.config/gwm/autostart.sh" // 在gwm剛啓動時執行的腳本
 #define CMD_CENTER_COL 4 // 操作中心按鈕列數
 #define MOVE_RESIZE_INC 8 // 移動窗口、調整窗口尺寸的步進值，單位爲像素。僅當窗口未有效設置尺寸特性時才使用它。
+#define MOTION_RATE_MAX 0 // 用定位器拖動時每秒最多處理的移動次數，通常可設爲顯示器刷新率。0表示不限制
+#define SINGLE_WIN_TITLE_BAR 0 // 1表示整個標題欄只用一個窗口，由窗口管理器按定位器坐標判斷所在的標題按鈕並自行繪制懸停效果，可大幅減少X服務器端的窗口數量；0表示每個標題按鈕各用一個窗口
+#define SHOW_PERF_STAT 0 // 1表示在退出時向標準錯誤輸出性能統計信息，0表示不輸出
 
 #define DEFAULT_FONT_PIXEL_SIZE 24 // 默認字體大小，單位爲像素
 #define TITLE_FONT_PIXEL_SIZE  DEFAULT_FONT_PIXEL_SIZE // 標題欄的字體大小，單位爲像素
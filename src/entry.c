@@ -45,7 +45,7 @@ void update_entry_text(WM *wm, Entry *e)
         e->text[0]==L'\0' ? wm->text_color[HINT_TEXT_COLOR] :
         wm->text_color[ENTRY_TEXT_COLOR], ENTRY_FONT};
     int x=get_entry_cursor_x(wm, e);
-    XClearArea(wm->display, e->win, 0, 0, e->w, e->h, False); 
+    clear_area(wm, e->win, 0, 0, e->w, e->h);
     draw_wcs(wm, e->win, e->text[0]==L'\0' ? e->hint : e->text, &f);
     XDrawLine(wm->display, e->win, wm->gc, x, 0, x, e->h);
 }
@@ -14,6 +14,14 @@
 #include "font.h"
 #include "misc.h"
 
+static XftDraw *get_xft_draw(WM *wm, Drawable d);
+static unsigned int get_text_width(WM *wm, XftFont *font, const char *str);
+static Text_extent **get_text_extent_bucket(Text_extent_cache *cache, XftFont *font, unsigned long hash);
+static Text_extent *alloc_text_extent(Text_extent_cache *cache);
+static void unlink_text_extent(Text_extent *e);
+static void clear_text_extents(WM *wm);
+static void clear_label_pixmaps(WM *wm);
+
 void load_font(WM *wm)
 {
     for(size_t i=0; i<FONT_N; i++)
@@ -31,22 +39,28 @@ void load_font(WM *wm)
 
 char *get_text_prop(WM *wm, Window win, Atom atom)
 {
-    int n;
-    char **list=NULL, *result=NULL;
+    char *result=NULL;
     XTextProperty name;
     if(XGetTextProperty(wm->display, win, &name, atom))
-    {
-        if(name.encoding == XA_STRING)
-            result=copy_string((char *)name.value);
-        else if(Xutf8TextPropertyToTextList(wm->display, &name, &list, &n) == Success)
-            result=copy_string(*list), XFreeStringList(list);
-        XFree(name.value);
-    }
+        result=get_text_prop_string(wm, &name), XFree(name.value);
     if(!result)
         result=copy_string(win==wm->taskbar.win ? "gwm" : "");
     return result;
 }
 
+/* 把已讀取的文本特性轉換爲UTF-8字符串，不能轉換時返回NULL。prop->value須以
+ * 空字符結尾。 */
+char *get_text_prop_string(WM *wm, XTextProperty *prop)
+{
+    int n;
+    char **list=NULL, *result=NULL;
+    if(prop->encoding == XA_STRING)
+        result=copy_string((char *)prop->value);
+    else if(Xutf8TextPropertyToTextList(wm->display, prop, &list, &n) == Success)
+        result=copy_string(*list), XFreeStringList(list);
+    return result;
+}
+
 void draw_wcs(WM *wm, Drawable d, const wchar_t *wcs, const String_format *f)
 {
     size_t n=wcslen(wcs)*MB_CUR_MAX+1;
@@ -61,6 +75,8 @@ void draw_string(WM *wm, Drawable d, const char *str, const String_format *f)
     {
         XftFont *font=wm->font[f->font_type];
         unsigned int w=f->r.w, h=f->r.h, lw, lh, n=strlen(str);
+        if(is_clipped_out(wm, f->r.x, f->r.y, w, h))
+            return;
         get_string_size(wm, font, str, &lw, &lh);
         int x=f->r.x, y=f->r.y, cx=x+w/2-lw/2, cy=y+h/2-lh/2+font->ascent,
             sx, sy, left=x, right=x+w-lw, top=y+lh, bottom=y+h;
@@ -76,32 +92,170 @@ void draw_string(WM *wm, Drawable d, const char *str, const String_format *f)
             case BOTTOM_CENTER: sx=cx, sy=bottom; break;
             case BOTTOM_RIGHT: sx=right, sy=bottom; break;
         }
-        XClearArea(wm->display, d, x, y, w, h, False); 
+        /* 填充背景色時不必先清除，且像素圖不能用XClearArea清除 */
         if(f->change_bg)
         {
             XSetForeground(wm->display, wm->gc, f->bg);
             XFillRectangle(wm->display, d, wm->gc, x, y, w, h);
         }
-        XftDraw *draw=XftDrawCreate(wm->display, d, wm->visual, wm->colormap);
-        XftDrawStringUtf8(draw, &f->fg, font, sx, sy, (const FcChar8 *)str, n);
-        XftDrawDestroy(draw);
+        else
+            clear_area(wm, d, x, y, w, h);
+        XftDraw *draw=get_xft_draw(wm, d);
+        if(draw)
+        {
+            if(wm->draw_clip)
+                XftDrawSetClip(draw, wm->draw_clip);
+            XftDrawStringUtf8(draw, &f->fg, font, sx, sy, (const FcChar8 *)str, n);
+            if(wm->draw_clip)
+                XftDrawSetClip(draw, NULL);
+        }
+    }
+}
+
+/* 按可繪制對象緩存XftDraw，以免每次繪制字符串都在X服務器上創建、銷毀
+ * Render圖片。須在銷毀相應的窗口之前調用del_xft_draw釋放它。 */
+static XftDraw *get_xft_draw(WM *wm, Drawable d)
+{
+    XPointer p;
+    if(!XFindContext(wm->display, d, wm->xft_draw_ctx, &p))
+        return (XftDraw *)p;
+
+    XftDraw *draw=XftDrawCreate(wm->display, d, wm->visual, wm->colormap);
+    if(draw)
+        XSaveContext(wm->display, d, wm->xft_draw_ctx, (XPointer)draw);
+    return draw;
+}
+
+void del_xft_draw(WM *wm, Drawable d)
+{
+    XPointer p;
+    if(d && !XFindContext(wm->display, d, wm->xft_draw_ctx, &p))
+    {
+        XftDrawDestroy((XftDraw *)p);
+        XDeleteContext(wm->display, d, wm->xft_draw_ctx);
     }
 }
 
 void get_string_size(WM *wm, XftFont *font, const char *str, unsigned int *w, unsigned int *h)
 {
-    /* libXrender文檔沒有解釋XGlyphInfo結構體成員的含義。
-       猜測xOff指字符串原點到字符串限定框最右邊的偏移量。*/
-    XGlyphInfo e;
-    XftTextExtentsUtf8(wm->display, font, (const FcChar8 *)str, strlen(str), &e);
     if(w)
-        *w=e.xOff;
+        *w=get_text_width(wm, font, str);
     if(h)
         *h=font->height;
 }
 
+/* 標題、按鈕文字等在重繪時反復出現，故用緩存避免反復計算其寬度 */
+static unsigned int get_text_width(WM *wm, XftFont *font, const char *str)
+{
+    Text_extent_cache *cache=&wm->text_extents;
+    unsigned long hash=get_string_hash(str);
+    Text_extent **bucket=get_text_extent_bucket(cache, font, hash), *e;
+
+    for(e=*bucket; e; e=e->hash_next)
+    {
+        if(e->font==font && e->hash==hash && strcmp(e->str, str)==0)
+        {
+            wm->perf_stat.text_extent_hits++;
+            unlink_text_extent(e);
+            break;
+        }
+    }
+    if(!e)
+    {
+        /* libXrender文檔沒有解釋XGlyphInfo結構體成員的含義。
+           猜測xOff指字符串原點到字符串限定框最右邊的偏移量。*/
+        XGlyphInfo gi;
+        XftTextExtentsUtf8(wm->display, font, (const FcChar8 *)str, strlen(str), &gi);
+        wm->perf_stat.text_extent_misses++;
+        e=alloc_text_extent(cache);
+        e->font=font, e->hash=hash, e->str=copy_string(str), e->w=gi.xOff;
+        bucket=get_text_extent_bucket(cache, font, hash);
+        e->hash_next=*bucket, *bucket=e;
+    }
+    e->prev=&cache->lru, e->next=cache->lru.next;
+    cache->lru.next->prev=e, cache->lru.next=e;
+    return e->w;
+}
+
+static Text_extent **get_text_extent_bucket(Text_extent_cache *cache, XftFont *font, unsigned long hash)
+{
+    hash^=(uintptr_t)font>>4;
+    return cache->buckets+hash%ARRAY_NUM(cache->buckets);
+}
+
+/* 取得一個空閑的緩存項，緩存已滿時淘汰最近最少使用的項 */
+static Text_extent *alloc_text_extent(Text_extent_cache *cache)
+{
+    if(!cache->n)
+        cache->lru.prev=cache->lru.next=&cache->lru;
+    if(cache->n < TEXT_EXTENT_CACHE_SIZE)
+        return cache->items+cache->n++;
+
+    Text_extent *e=cache->lru.prev, **pp;
+    unlink_text_extent(e);
+    for(pp=get_text_extent_bucket(cache, e->font, e->hash); *pp!=e; pp=&(*pp)->hash_next)
+        ;
+    *pp=e->hash_next;
+    free(e->str);
+    return e;
+}
+
+static void unlink_text_extent(Text_extent *e)
+{
+    e->prev->next=e->next, e->next->prev=e->prev;
+}
+
+static void clear_text_extents(WM *wm)
+{
+    Text_extent_cache *cache=&wm->text_extents;
+    for(size_t i=0; i<cache->n; i++)
+        free(cache->items[i].str);
+    memset(cache->buckets, 0, sizeof(cache->buckets));
+    cache->n=0;
+}
+
+/* 返回按格式f繪制了靜態標籤文字text的像素圖，繪制位置取f->r的寬、高。
+ * 同樣的(文字, 字體, 對齊方式, 顏色, 尺寸)只繪制一次，之後的懸停、布局切換
+ * 只需更換構件的背景像素圖而不再調用Xft。text不被復制，故應在程序運行期間
+ * 一直有效；返回的像素圖歸緩存所有。 */
+Pixmap get_label_pixmap(WM *wm, const char *text, const String_format *f)
+{
+    unsigned long fg=f->fg.pixel, hash=get_string_hash(text);
+    hash=(hash^f->bg^(fg<<8)^f->font_type)%LABEL_PIXMAP_BUCKET_N;
+    Label_pixmap **pp=wm->label_pixmaps+hash, *p;
+
+    for(p=*pp; p; p=p->next)
+        if( p->font_type==f->font_type && p->align==f->align && p->fg==fg
+            && p->bg==f->bg && p->w==f->r.w && p->h==f->r.h
+            && strcmp(p->text, text)==0)
+            return p->pixmap;
+
+    p=malloc_s(sizeof(Label_pixmap));
+    *p=(Label_pixmap){text, f->font_type, f->align, fg, f->bg, f->r.w, f->r.h,
+        XCreatePixmap(wm->display, wm->root_win, f->r.w, f->r.h,
+        DefaultDepth(wm->display, wm->screen)), *pp};
+    *pp=p;
+    String_format lf=*f;
+    lf.r.x=lf.r.y=0, lf.change_bg=true;
+    draw_string(wm, p->pixmap, text, &lf);
+    del_xft_draw(wm, p->pixmap); // 像素圖不會再繪制文字
+    return p->pixmap;
+}
+
+static void clear_label_pixmaps(WM *wm)
+{
+    for(size_t i=0; i<LABEL_PIXMAP_BUCKET_N; i++)
+    {
+        for(Label_pixmap *p=wm->label_pixmaps[i], *next=NULL; p; p=next)
+            next=p->next, XFreePixmap(wm->display, p->pixmap), free(p);
+        wm->label_pixmaps[i]=NULL;
+    }
+}
+
 void close_fonts(WM *wm)
 {
+    clear_label_pixmaps(wm);
+    clear_text_extents(wm);
     for(size_t i=0, j=0; i<FONT_N; i++)
     {
         for(j=0; j<i; j++)
@@ -14,8 +14,11 @@
 
 void load_font(WM *wm);
 char *get_text_prop(WM *wm, Window win, Atom atom);
+char *get_text_prop_string(WM *wm, XTextProperty *prop);
 void draw_wcs(WM *wm, Drawable d, const wchar_t *wcs, const String_format *f);
 void draw_string(WM *wm, Drawable d, const char *str, const String_format *f);
+void del_xft_draw(WM *wm, Drawable d);
+Pixmap get_label_pixmap(WM *wm, const char *text, const String_format *f);
 void get_string_size(WM *wm, XftFont *font, const char *str, unsigned int *w, unsigned int *h);
 void close_fonts(WM *wm);
 
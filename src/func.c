@@ -9,6 +9,9 @@
  * <http://www.gnu.org/licenses/>。
  * ************************************************************************/
 
+#define _POSIX_C_SOURCE 200809L // 爲了使用sigprocmask
+
+#include <poll.h>
 #include <time.h>
 #include <unistd.h>
 #include "gwm.h"
@@ -21,9 +24,11 @@
 #include "handler.h"
 #include "hint.h"
 #include "icon.h"
+#include "icon_loader.h"
 #include "layout.h"
 #include "menu.h"
 #include "misc.h"
+#include "timer.h"
 
 static Delta_rect get_key_delta_rect(Client *c, Direction dir);
 static bool is_prefer_move_resize(WM *wm, Client *c, Delta_rect *d);
@@ -33,6 +38,8 @@ static bool is_match_click(WM *wm, XEvent *oe, XEvent *ne);
 static bool get_valid_click(WM *wm, Pointer_act act, XEvent *oe, XEvent *ne);
 static void do_valid_pointer_move_resize(WM *wm, Client *c, Move_info *m, Pointer_act act, bool is_resize);
 static void update_hint_win_for_resize(WM *wm, Client *c);
+static void get_drag_event(WM *wm, XEvent *ev, struct timespec *last);
+static void compress_motion(WM *wm, XEvent *ev);
 static Delta_rect get_pointer_delta_rect(Client *c, const Move_info *m, Pointer_act act);
 static void print_area(Drawable d, int x, int y, unsigned int w, unsigned int h);
 
@@ -50,6 +57,9 @@ void exec(WM *wm, XEvent *e, Func_arg arg)
     pid_t pid=fork();
 	if(pid == 0)
     {
+        sigset_t set; // 主循環用signalfd接收的信號在子進程中須解除屏蔽
+        sigemptyset(&set);
+        sigprocmask(SIG_SETMASK, &set, NULL);
 		if(wm->display)
             close(ConnectionNumber(wm->display));
 		if(!setsid())
@@ -76,6 +86,7 @@ void key_move_resize_client(WM *wm, XEvent *e, Func_arg arg)
             while(1)
             {
                 XEvent ev;
+                handle_deferred_work(wm);
                 XMaskEvent(wm->display, ROOT_EVENT_MASK|KeyReleaseMask, &ev);
                 if( ev.type==KeyRelease && ev.xkey.state==e->xkey.state
                     && ev.xkey.keycode==e->xkey.keycode)
@@ -259,6 +270,7 @@ static bool get_valid_click(WM *wm, Pointer_act act, XEvent *oe, XEvent *ne)
     {
         do
         {
+            handle_deferred_work(wm);
             XMaskEvent(wm->display, ROOT_EVENT_MASK|POINTER_MASK, ne);
             handle_event(wm, ne);
         }while(!is_match_click(wm, oe, ne));
@@ -314,9 +326,10 @@ void pointer_move_resize_client(WM *wm, XEvent *e, Func_arg arg)
         return;
 
     XEvent ev;
+    struct timespec last={0, 0};
     do /* 因設置了獨享定位器且XMaskEvent會阻塞，故應處理按、放按鈕之間的事件 */
     {
-        XMaskEvent(wm->display, ROOT_EVENT_MASK|POINTER_MASK, &ev);
+        get_drag_event(wm, &ev, &last);
         if(ev.type == MotionNotify)
         {
             if(c->area_type!=FLOATING_AREA && layout==TILE)
@@ -352,6 +365,44 @@ static void do_valid_pointer_move_resize(WM *wm, Client *c, Move_info *m, Pointe
     }
 }
 
+/* 獲取拖動過程中的下一個事件。隊列中連續的MotionNotify事件只保留最新的
+ * 一個。若MOTION_RATE_MAX非0，則相鄰兩次返回MotionNotify的時間間隔不小於
+ * 其倒數，其間到達的移動事件亦被合併。last爲上次返回MotionNotify的時刻。 */
+static void get_drag_event(WM *wm, XEvent *ev, struct timespec *last)
+{
+    handle_deferred_work(wm);
+    XMaskEvent(wm->display, ROOT_EVENT_MASK|POINTER_MASK, ev);
+    if(ev->type != MotionNotify)
+        return;
+
+    compress_motion(wm, ev);
+#if MOTION_RATE_MAX
+    long ms;
+    struct pollfd pfd={.fd=ConnectionNumber(wm->display), .events=POLLIN};
+    while( (ms=get_remaining_ms(last, 1000/MOTION_RATE_MAX))
+        && !XEventsQueued(wm->display, QueuedAfterFlush))
+    {
+        poll(&pfd, 1, ms);
+        compress_motion(wm, ev);
+    }
+    clock_gettime(CLOCK_MONOTONIC, last);
+#endif
+}
+
+/* 用隊列中緊隨ev之後的連續MotionNotify事件中最新的一個替換ev */
+static void compress_motion(WM *wm, XEvent *ev)
+{
+    XEvent next;
+    while(XEventsQueued(wm->display, QueuedAfterReading))
+    {
+        XPeekEvent(wm->display, &next);
+        if(next.type != MotionNotify)
+            break;
+        XNextEvent(wm->display, ev);
+        wm->perf_stat.coalesced_motions++;
+    }
+}
+
 static void update_hint_win_for_resize(WM *wm, Client *c)
 {
     char str[BUFSIZ];
@@ -421,9 +472,10 @@ void adjust_layout_ratio(WM *wm, XEvent *e, Func_arg arg)
         return;
     int ox=e->xbutton.x_root, nx, dx;
     XEvent ev;
+    struct timespec last={0, 0};
     do /* 因設置了獨享定位器且XMaskEvent會阻塞，故應處理按、放按鈕之間的事件 */
     {
-        XMaskEvent(wm->display, ROOT_EVENT_MASK|POINTER_MASK, &ev);
+        get_drag_event(wm, &ev, &last);
         if(ev.type == MotionNotify)
         {
             nx=ev.xmotion.x, dx=nx-ox;
@@ -484,11 +536,7 @@ void toggle_title_bar_visibility(WM *wm, XEvent *e, Func_arg arg)
         XMapSubwindows(wm->display, c->frame);
     }
     else
-    {
-        for(size_t i=0; i<TITLE_BUTTON_N; i++)
-            XDestroyWindow(wm->display, c->buttons[i]);
-        XDestroyWindow(wm->display, c->title_area);
-    }
+        del_title_bar(wm, c);
     update_layout(wm);
 }
 
@@ -596,7 +644,7 @@ void change_wallpaper(WM *wm, XEvent *e, Func_arg arg)
 #ifdef WALLPAPER_PATHS
     File *f;
     for(f=wm->wallpapers->next; f; f=f->next)
-        if(!strcmp(f->name, wm->cur_wallpaper->name))
+        if(f == wm->cur_wallpaper)
             break;
     if(!f || !f->next)
         f=wm->wallpapers;
@@ -626,6 +674,7 @@ void print_win(WM *wm, XEvent *e, Func_arg arg)
 
 static void print_area(Drawable d, int x, int y, unsigned int w, unsigned int h)
 {
+    lock_imlib();
     imlib_context_set_drawable(d);
     Imlib_Image image=imlib_create_image_from_drawable(None, x, y, w, h, 0);
     if(image)
@@ -641,4 +690,5 @@ static void print_area(Drawable d, int x, int y, unsigned int w, unsigned int h)
         imlib_save_image(name);
         imlib_free_image();
     }
+    unlock_imlib();
 }
@@ -16,48 +16,176 @@
 #include "layout.h"
 #include "misc.h"
 
-static unsigned int get_num_lock_mask(WM *wm);
+static void update_bind_index(WM *wm);
+static size_t add_bind_index(Bind_index *table[], unsigned long key, const void *bind);
+static void clear_bind_index_table(Bind_index *table[]);
+static size_t get_bind_index_hash(unsigned long key);
+static unsigned long get_key_index_key(WM *wm, unsigned int keycode, unsigned int mask);
+static unsigned long get_button_index_key(WM *wm, Widget_type type, unsigned int button, unsigned int mask);
+static void get_lock_masks(WM *wm, unsigned int masks[LOCK_MASKS_N]);
 static unsigned int get_valid_mask(WM *wm, unsigned int mask);
 static unsigned int get_modifier_mask(WM *wm, KeySym key_sym);
 
+/* 文件作用域的複合字面量具有靜態存儲期，故可以只構造一次綁定表並建立指向
+ * 其元素的索引 */
+static const Keybind *keybinds=KEYBIND;
+static const size_t keybinds_n=ARRAY_NUM(KEYBIND);
+static const Buttonbind *buttonbinds=BUTTONBIND;
+static const size_t buttonbinds_n=ARRAY_NUM(BUTTONBIND);
+
+/* 獲取功能轉換鍵映射並計算各鎖定鍵的掩碼。僅在啓動時和收到MappingNotify
+ * 事件時調用，此後比較功能轉換鍵掩碼只需位運算。 */
+void update_modifier_masks(WM *wm)
+{
+    if(wm->mod_map)
+        XFreeModifiermap(wm->mod_map);
+    wm->mod_map=XGetModifierMapping(wm->display);
+    wm->caps_lock_mask=get_modifier_mask(wm, XK_Caps_Lock)|LockMask;
+    wm->num_lock_mask=get_modifier_mask(wm, XK_Num_Lock);
+    wm->scroll_lock_mask=get_modifier_mask(wm, XK_Scroll_Lock);
+}
+
 void grab_keys(WM *wm)
 {
-    unsigned int num_lock_mask=get_num_lock_mask(wm);
-    unsigned int masks[]={0, LockMask, num_lock_mask, num_lock_mask|LockMask};
+    unsigned int masks[LOCK_MASKS_N];
     KeyCode code;
+    get_lock_masks(wm, masks);
     XUngrabKey(wm->display, AnyKey, AnyModifier, wm->root_win);
-    for(size_t i=0; i<ARRAY_NUM(KEYBIND); i++)
-        if((code=XKeysymToKeycode(wm->display, KEYBIND[i].keysym)))
-            for(size_t j=0; j<ARRAY_NUM(masks); j++)
-                XGrabKey(wm->display, code, KEYBIND[i].modifier|masks[j],
+    for(size_t i=0; i<keybinds_n; i++)
+        if((code=XKeysymToKeycode(wm->display, keybinds[i].keysym)))
+            for(size_t j=0; j<LOCK_MASKS_N; j++)
+                XGrabKey(wm->display, code, keybinds[i].modifier|masks[j],
                     wm->root_win, True, GrabModeAsync, GrabModeAsync);
+    update_bind_index(wm);
 }
 
-static unsigned int get_num_lock_mask(WM *wm)
+/* 用一次XGetKeyboardMapping請求取得所有鍵代碼的鍵符號，據此建立按鍵綁定
+ * 的索引，使處理按鍵事件時不必往返X服務器；同時重建按鈕綁定的索引。 */
+static void update_bind_index(WM *wm)
 {
-	XModifierKeymap *m=XGetModifierMapping(wm->display);
-    KeyCode code=XKeysymToKeycode(wm->display, XK_Num_Lock);
-    if(code)
-        for(size_t i=0; i<8; i++)
-            for(size_t j=0; j<m->max_keypermod; j++)
-                if(m->modifiermap[i*m->max_keypermod+j] == code)
-                    { XFreeModifiermap(m); return (1<<i); }
-    return 0;
+    int min, max, n;
+    size_t m;
+    KeySym *ks;
+
+    clear_bind_index(wm);
+    XDisplayKeycodes(wm->display, &min, &max);
+    if((ks=XGetKeyboardMapping(wm->display, min, max-min+1, &n)))
+    {
+        for(int code=min; code<=max; code++)
+            for(size_t i=0; i<keybinds_n; i++)
+                if(ks[(code-min)*n] == keybinds[i].keysym)
+                {
+                    m=add_bind_index(wm->key_index, get_key_index_key(wm,
+                        code, keybinds[i].modifier), keybinds+i);
+                    wm->key_match_max=MAX(wm->key_match_max, m);
+                }
+        XFree(ks);
+    }
+    for(size_t i=0; i<buttonbinds_n; i++)
+    {
+        const Buttonbind *b=buttonbinds+i;
+        m=add_bind_index(wm->button_index, get_button_index_key(wm,
+            b->widget_type, b->button, b->modifier), b);
+        wm->button_match_max=MAX(wm->button_match_max, m);
+    }
+}
+
+/* 新結點加在鏈表末尾，以保持綁定在配置中的先後次序。返回加入後鍵值爲key的
+ * 綁定數。 */
+static size_t add_bind_index(Bind_index *table[], unsigned long key, const void *bind)
+{
+    size_t n=1;
+    Bind_index *p=malloc_s(sizeof(Bind_index)), **pp;
+    p->key=key, p->bind=bind, p->next=NULL;
+    for(pp=table+get_bind_index_hash(key); *pp; pp=&(*pp)->next)
+        n += (*pp)->key==key;
+    *pp=p;
+    return n;
+}
+
+void clear_bind_index(WM *wm)
+{
+    clear_bind_index_table(wm->key_index);
+    clear_bind_index_table(wm->button_index);
+    wm->key_match_max=wm->button_match_max=0;
+}
+
+static void clear_bind_index_table(Bind_index *table[])
+{
+    for(size_t i=0; i<BIND_INDEX_SIZE; i++)
+    {
+        for(Bind_index *p=table[i], *next=NULL; p; p=next)
+            next=p->next, free(p);
+        table[i]=NULL;
+    }
+}
+
+/* 乘法散列，取積的高位 */
+static size_t get_bind_index_hash(unsigned long key)
+{
+    return (uint32_t)(key*2654435761U) >> (32-BIND_INDEX_BITS);
+}
+
+static unsigned long get_key_index_key(WM *wm, unsigned int keycode, unsigned int mask)
+{
+    return (unsigned long)keycode<<8 | get_valid_mask(wm, mask);
+}
+
+static unsigned long get_button_index_key(WM *wm, Widget_type type, unsigned int button, unsigned int mask)
+{
+    return (unsigned long)type<<16 | (button&0xff)<<8 | get_valid_mask(wm, mask);
+}
+
+/* 把與按鍵相符的綁定按配置次序存入binds，返回其數量。binds至少應能容納
+ * wm->key_match_max項。 */
+size_t get_keybinds(WM *wm, unsigned int keycode, unsigned int state, const Keybind *binds[])
+{
+    size_t n=0;
+    unsigned long key=get_key_index_key(wm, keycode, state);
+    for(Bind_index *p=wm->key_index[get_bind_index_hash(key)]; p; p=p->next)
+        if(p->key == key)
+            binds[n++]=p->bind;
+    return n;
 }
-    
+
+/* 把與按鈕相符的綁定按配置次序存入binds，返回其數量。binds至少應能容納
+ * wm->button_match_max項。 */
+size_t get_buttonbinds(WM *wm, Widget_type type, unsigned int button, unsigned int state, const Buttonbind *binds[])
+{
+    size_t n=0;
+    unsigned long key=get_button_index_key(wm, type, button, state);
+    for(Bind_index *p=wm->button_index[get_bind_index_hash(key)]; p; p=p->next)
+        if(p->key == key)
+            binds[n++]=p->bind;
+    return n;
+}
+
+/* 求出Caps_Lock、Num_Lock、Scroll_Lock的掩碼的所有組合 */
+static void get_lock_masks(WM *wm, unsigned int masks[LOCK_MASKS_N])
+{
+    unsigned int locks[]={wm->caps_lock_mask, wm->num_lock_mask, wm->scroll_lock_mask};
+    for(size_t i=0; i<LOCK_MASKS_N; i++)
+    {
+        masks[i]=0;
+        for(size_t j=0; j<ARRAY_NUM(locks); j++)
+            if(i & (1<<j))
+                masks[i] |= locks[j];
+    }
+}
+
 void grab_buttons(WM *wm, Client *c)
 {
-    unsigned int num_lock_mask=get_num_lock_mask(wm),
-                 masks[]={0, LockMask, num_lock_mask, num_lock_mask|LockMask};
-    Buttonbind *p=BUTTONBIND;
+    unsigned int masks[LOCK_MASKS_N];
+    const Buttonbind *p=buttonbinds;
+    get_lock_masks(wm, masks);
     XUngrabButton(wm->display, AnyButton, AnyModifier, c->win);
-    for(size_t i=0; i<ARRAY_NUM(BUTTONBIND); i++, p++)
+    for(size_t i=0; i<buttonbinds_n; i++, p++)
     {
         if(p->widget_type == CLIENT_WIN)
         {
             int m=is_equal_modifier_mask(wm, 0, p->modifier) ?
                 GrabModeSync : GrabModeAsync;
-            for(size_t j=0; j<ARRAY_NUM(masks); j++)
+            for(size_t j=0; j<LOCK_MASKS_N; j++)
                 XGrabButton(wm->display, p->button, p->modifier|masks[j],
                     c->win, False, BUTTON_MASK, m, m, None, None);
         }
@@ -71,22 +199,18 @@ bool is_equal_modifier_mask(WM *wm, unsigned int m1, unsigned int m2)
 
 static unsigned int get_valid_mask(WM *wm, unsigned int mask)
 {
-    return (mask & ~(LockMask|get_modifier_mask(wm, XK_Num_Lock))
+    return (mask & ~(wm->caps_lock_mask|wm->num_lock_mask|wm->scroll_lock_mask)
         & (ShiftMask|ControlMask|Mod1Mask|Mod2Mask|Mod3Mask|Mod4Mask|Mod5Mask));
 }
 
+/* 鎖定鍵未綁定到功能轉換鍵是正常情況，此時返回0 */
 static unsigned int get_modifier_mask(WM *wm, KeySym key_sym)
 {
     KeyCode kc;
     if((kc=XKeysymToKeycode(wm->display, key_sym)) != 0)
-    {
         for(size_t i=0; i<8*wm->mod_map->max_keypermod; i++)
             if(wm->mod_map->modifiermap[i] == kc)
                 return 1 << (i/wm->mod_map->max_keypermod);
-        fprintf(stderr, "錯誤：找不到指定的鍵符號相應的功能轉換鍵！\n");
-    }
-    else
-        fprintf(stderr, "錯誤：指定的鍵符號不存在對應的鍵代碼！\n");
     return 0;
 }
 
@@ -12,8 +12,12 @@
 #ifndef GRAB_H
 #define GRAB_H
 
+void update_modifier_masks(WM *wm);
 void grab_keys(WM *wm);
 void grab_buttons(WM *wm, Client *c);
+void clear_bind_index(WM *wm);
+size_t get_keybinds(WM *wm, unsigned int keycode, unsigned int state, const Keybind *binds[]);
+size_t get_buttonbinds(WM *wm, Widget_type type, unsigned int button, unsigned int state, const Buttonbind *binds[]);
 bool is_equal_modifier_mask(WM *wm, unsigned int m1, unsigned int m2);
 bool grab_pointer(WM *wm, Pointer_act act);
 
@@ -9,6 +9,11 @@
  * <http://www.gnu.org/licenses/>。
  * ************************************************************************/
 
+#define _POSIX_C_SOURCE 200809L // 爲了使用pthread_sigmask
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
 #include "config.h"
 #include "gwm.h"
 #include "client.h"
@@ -22,6 +27,7 @@
 #include "misc.h"
 
 static void set_signals(void);
+static int create_signal_fd(void);
 static void ready_to_quit(int unused);
 
 sig_atomic_t run_flag=1;
@@ -32,7 +38,7 @@ int main(int argc, char *argv[])
     set_signals();
     clear_zombies(0);
     init_wm(&wm);
-    init_imlib(&wm);
+    wm.signal_fd=create_signal_fd();
     init_root_win_background(&wm);
     XSetScreenSaver(wm.display, SCREEN_SAVER_TIME_OUT, SCREEN_SAVER_INTERVAL,
         PreferBlanking, AllowExposures);
@@ -53,6 +59,27 @@ static void set_signals(void)
         perror("不能安裝SIGQUIT信號處理函數");
 }
 
+/* 屏蔽信號並改由signalfd在主循環中接收它們。若失敗，則解除屏蔽，
+ * 仍由set_signals安裝的信號處理函數處理。 */
+static int create_signal_fd(void)
+{
+    int fd;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGQUIT);
+    if((errno=pthread_sigmask(SIG_BLOCK, &set, NULL)))
+        return perror("不能屏蔽信號"), -1;
+    if((fd=signalfd(-1, &set, SFD_NONBLOCK|SFD_CLOEXEC)) == -1)
+    {
+        perror("不能創建signalfd");
+        pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+    }
+    return fd;
+}
+
 static void ready_to_quit(int unused)
 {
     run_flag=0;
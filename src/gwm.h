@@ -15,15 +15,20 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 #include <wchar.h>
 #include <Imlib2.h>
 #include <X11/Xatom.h>
 #include <X11/Xproto.h>
+#include <X11/Xresource.h>
+#include <X11/Xutil.h>
 #include <X11/Xft/Xft.h>
 #include "config.h"
 
 #define ICCCM_NAMES (const char *[]) {"WM_PROTOCOLS", "WM_DELETE_WINDOW", "WM_TAKE_FOCUS"}
 #define EWMH_NAME (const char *[]) {"_NET_WM_WINDOW_TYPE", "_NET_WM_WINDOW_TYPE_NORMAL", "_NET_WM_STATE", "_NET_WM_STATE_MODAL", "_NET_WM_ICON"} 
+#define WALLPAPER_EXTS (const char *[]) {"png", "jpg"}
 
 #define MIN(a, b) ((a)<(b) ? (a) : (b))
 #define MAX(a, b) ((a)>(b) ? (a) : (b))
@@ -42,11 +47,15 @@
 #define CROSSING_MASK (EnterWindowMask|LeaveWindowMask)
 #define ROOT_EVENT_MASK (SubstructureRedirectMask|SubstructureNotifyMask| \
     PropertyChangeMask|ButtonPressMask|CROSSING_MASK|ExposureMask|KeyPressMask)
-#define BUTTON_EVENT_MASK (ButtonPressMask|ExposureMask|CROSSING_MASK)
+#define BUTTON_EVENT_MASK (ButtonPressMask|CROSSING_MASK)
 #define FRAME_EVENT_MASK (SubstructureRedirectMask|SubstructureNotifyMask| \
     ExposureMask|ButtonPressMask|CROSSING_MASK|FocusChangeMask)
-#define TITLE_AREA_EVENT_MASK (ButtonPressMask|ExposureMask|CROSSING_MASK)
-#define ICON_WIN_EVENT_MASK (BUTTON_EVENT_MASK|PointerMotionMask)
+#if SINGLE_WIN_TITLE_BAR
+#define TITLE_AREA_EVENT_MASK (ButtonPressMask|CROSSING_MASK|PointerMotionMask)
+#else
+#define TITLE_AREA_EVENT_MASK (ButtonPressMask|CROSSING_MASK)
+#endif
+#define ICON_WIN_EVENT_MASK (BUTTON_EVENT_MASK|ExposureMask|PointerMotionMask)
 #define ENTRY_EVENT_MASK (ButtonPressMask|KeyPressMask|ExposureMask)
 
 #define TITLE_BUTTON_INDEX(type) ((type)-TITLE_BUTTON_BEGIN)
@@ -61,8 +70,20 @@
 #define IS_CMD_CENTER_ITEM(type) \
     ((type)>=CMD_CENTER_ITEM_BEGIN && (type)<=CMD_CENTER_ITEM_END)
 
+#define LOCK_MASKS_N 8 // Caps_Lock、Num_Lock、Scroll_Lock的掩碼的組合數
+#define BIND_INDEX_BITS 8 // 按鍵、按鈕綁定的散列表的桶數的二進制位數
+#define BIND_INDEX_SIZE (1<<BIND_INDEX_BITS) // 按鍵、按鈕綁定的散列表的桶數
+#define TEXT_EXTENT_CACHE_SIZE 128 // 文本寬度緩存的最大項數
+#define LABEL_PIXMAP_BUCKET_N 64 // 靜態標籤像素圖散列表的桶數
+
 #define DESKTOP(wm) (wm->desktop[wm->cur_desktop-1])
 
+enum watch_type_tag // inotify監視的目錄的類型
+{
+    WALLPAPER_WATCH, ICON_THEME_WATCH,
+};
+typedef enum watch_type_tag Watch_type;
+
 enum order_tag // 文件名排序类型
 {
     RISE=-1, NOSORT=0, FALL=1 // 依次为升序、不排序、降序
@@ -133,6 +154,44 @@ struct rectangle_tag // 矩形窗口的坐標和尺寸
 };
 typedef struct rectangle_tag Rect;
 
+enum icon_source_tag // 圖符圖像的來源
+{
+    ICON_FROM_HINT, ICON_FROM_PROP, ICON_FROM_FILE,
+};
+typedef enum icon_source_tag Icon_source;
+
+struct icon_image_tag // 已縮放的圖符圖像，由同一程序的各客戶窗口共享
+{
+    Icon_source source; // 圖像的來源
+    /* 來源爲WM_HINTS時爲其中的圖符像素圖ID；來源爲_NET_WM_ICON而沒有res_class
+     * 時爲客戶窗口ID，以便加載完成時找到該圖像；否則爲0 */
+    unsigned long id;
+    char *name; // 來源爲_NET_WM_ICON時爲res_class，爲圖標文件時爲res_name
+    unsigned int size; // 縮放後的尺寸
+    unsigned int refs; // 引用計數
+    Pixmap pixmap, mask; // 縮放後的像素圖及其形狀掩碼
+    struct icon_image_tag *next;
+};
+typedef struct icon_image_tag Icon_image;
+
+struct icon_load_tag // 加載線程的任務：加載或縮放圖標圖像，或按文件變化更新圖標主題
+{
+    bool is_update; // 是否爲更新圖標主題的任務
+    Icon_source source; // 加載任務中圖像的來源
+    unsigned long id; // 加載任務中圖像的鍵值，同Icon_image的id
+    /* 對於加載任務，爲圖像的鍵值，同Icon_image的name；對於更新任務，爲變化
+     * 的文件名，爲NULL時表示全部重建 */
+    char *name;
+    char *dir; // 更新任務中變化的文件所在的目錄
+    bool is_added; // 更新任務中的文件是新增的還是刪除的
+    unsigned int w, h; // 原圖像的寬和高
+    DATA32 *src; // 主循環已讀取的原圖像ARGB像素數據，來源爲圖標文件時爲NULL
+    unsigned int size; // 縮放後的尺寸
+    DATA32 *data; // 縮放後的ARGB像素數據，找不到或不能解碼圖標時爲NULL
+    struct icon_load_tag *next;
+};
+typedef struct icon_load_tag Icon_load;
+
 struct icon_tag // 縮微窗口相關信息
 {
     Window win; // 縮微窗口
@@ -150,10 +209,20 @@ struct client_tag // 客戶窗口相關信息
     int x, y; // win的橫、縱坐標
     /* win的寬、高、標題欄高、邊框寬、所属虚拟桌面的掩碼 */
     unsigned int w, h, title_bar_h, border_w, desktop_mask;
+    /* 最近一次實際設置的win、frame、title_area、首個標題按鈕的坐標和尺寸，
+     * 寬爲0表示未知。其余標題按鈕的位置由首個按鈕確定。 */
+    Rect win_rect, frame_rect, title_area_rect, button_rect;
+    Pixmap title_pixmap; // 標題區的背景像素圖，其上已繪有背景色和標題文字
+    unsigned int title_pixmap_w; // title_pixmap的寬度
+    bool is_title_pixmap_focused; // title_pixmap是否按聚焦狀態繪制
+    /* 單窗口標題欄模式下，分別爲指針所在的標題欄構件、title_pixmap繪制時的
+     * 該構件、title_pixmap上所繪的標題按鈕數量 */
+    Widget_type title_hover, title_pixmap_hover;
+    unsigned int title_pixmap_buttons_n;
     Area_type area_type; // 區域類型
     char *title_text; // 標題的文字
     Icon *icon; // 圖符信息
-    Imlib_Image image; // 圖符的圖像
+    Icon_image *icon_image; // 共享的已縮放圖符圖像
     const char *class_name; // 客戶窗口的程序類型名
     XClassHint class_hint; // 客戶窗口的程序類型特性提示
     XSizeHints size_hint; // 客戶窗口的窗口尺寸條件特性提示
@@ -162,6 +231,19 @@ struct client_tag // 客戶窗口相關信息
 };
 typedef struct client_tag Client;
 
+struct client_props_tag // 添加客戶窗口時成批讀取的窗口特性
+{
+    Window owner; // 臨時窗口對應的主窗口，即WM_TRANSIENT_FOR
+    char *title_text; // 標題的文字，即WM_NAME
+    bool has_size_hint, has_class_hint; // 是否有相應的特性
+    XSizeHints size_hint; // 未經修正的窗口尺寸條件特性提示
+    XClassHint class_hint; // 程序類型特性提示，成員以malloc分配
+    XWMHints *wm_hint; // 窗口管理程序條件特性提示，無此特性時爲NULL
+    Atom type, state; // _NET_WM_WINDOW_TYPE和_NET_WM_STATE的首項
+    XWindowAttributes attr; // 只有x、y、width、height有效
+};
+typedef struct client_props_tag Client_props;
+
 enum layout_tag // 窗口管理器的布局模式
 {
     FULL, PREVIEW, STACK, TILE,
@@ -206,6 +288,7 @@ struct desktop_tag // 虛擬桌面相關信息
     Layout cur_layout, prev_layout; // 分別爲當前布局模式和前一個布局模式
     Area_type default_area_type; // 默認的窗口區域類型
     double main_area_ratio, fixed_area_ratio; // 分別爲主要和固定區域屏佔比
+    bool is_layout_dirty; // 布局是否需要更新
 };
 typedef struct desktop_tag Desktop;
 
@@ -253,6 +336,84 @@ struct entry_tag
 };
 typedef struct entry_tag Entry;
 
+struct bind_index_tag // 按鍵、按鈕綁定的散列索引結點
+{
+    /* 由鍵代碼和功能轉換鍵掩碼，或由構件類型、按鈕和功能轉換鍵掩碼合成的鍵值 */
+    unsigned long key;
+    const void *bind; // 相應的Keybind或Buttonbind
+    struct bind_index_tag *next;
+};
+typedef struct bind_index_tag Bind_index;
+
+struct text_extent_tag // 文本寬度緩存項
+{
+    XftFont *font; // 文本所用的字體
+    unsigned long hash; // 文本的散列值
+    char *str; // 文本，用於排除散列衝突
+    unsigned int w; // 文本的寬度
+    struct text_extent_tag *prev, *next; // 分別爲最近最少使用鏈表的前、後節點
+    struct text_extent_tag *hash_next; // 同一散列桶中的下一項
+};
+typedef struct text_extent_tag Text_extent;
+
+struct text_extent_cache_tag // 按最近最少使用策略淘汰的文本寬度緩存
+{
+    Text_extent items[TEXT_EXTENT_CACHE_SIZE], *buckets[TEXT_EXTENT_CACHE_SIZE*2];
+    Text_extent lru; // 最近最少使用鏈表的頭結點，其後爲最近使用的項
+    size_t n; // 已使用的項數
+};
+typedef struct text_extent_cache_tag Text_extent_cache;
+
+enum align_type_tag // 文字對齊方式
+{
+    TOP_LEFT, TOP_CENTER, TOP_RIGHT,
+    CENTER_LEFT, CENTER, CENTER_RIGHT,
+    BOTTOM_LEFT, BOTTOM_CENTER, BOTTOM_RIGHT,
+};
+typedef enum align_type_tag Align_type;
+
+struct label_pixmap_tag // 預先繪制好的靜態標籤，用作構件的背景像素圖
+{
+    const char *text; // 標籤文字
+    Font_type font_type; // 字體類型
+    Align_type align; // 對齊方式
+    unsigned long fg, bg; // 分別爲文字顏色、背景色的像素值
+    unsigned int w, h; // 像素圖的寬、高
+    Pixmap pixmap; // 繪有背景色和標籤文字的像素圖
+    struct label_pixmap_tag *next; // 同一散列桶中的下一項
+};
+typedef struct label_pixmap_tag Label_pixmap;
+
+struct perf_stat_tag // 性能統計信息，用於調優
+{
+    unsigned long coalesced_motions; // 因合併而被丟棄的MotionNotify事件數
+    unsigned long layout_requests, layout_passes; // 分別爲請求更新布局的次數、實際更新布局的次數
+    unsigned long skipped_geometry_requests; // 因幾何信息未變而省去的窗口配置請求數
+    unsigned long text_extent_hits, text_extent_misses; // 分別爲文本寬度緩存的命中、未命中次數
+};
+typedef struct perf_stat_tag Perf_stat;
+
+struct wm_tag;
+
+struct timer_tag // 定時器，按到期時刻升序鏈接
+{
+    struct timespec deadline; // 到期時刻（CLOCK_MONOTONIC）
+    void (*func)(struct wm_tag *wm, void *arg); // 到期時要調用的函數
+    void *arg; // func的參數
+    struct timer_tag *next;
+};
+typedef struct timer_tag Timer;
+
+struct hover_tag // 定位器懸停的相關信息
+{
+    Window win; // 定位器所在的窗口，爲None時表示不必判定懸停
+    Widget_type type; // win的構件類型
+    struct timespec time; // 定位器在win上最近一次移動的時刻
+    Timer *timer; // 判定懸停的定時器
+    bool is_shown; // 是否已經顯示懸停提示
+};
+typedef struct hover_tag Hover;
+
 struct wm_tag // 窗口管理器相關信息
 {
     Display *display; // 顯示器
@@ -261,6 +422,11 @@ struct wm_tag // 窗口管理器相關信息
     unsigned int cur_desktop; // 當前虛擬桌面編號
     Desktop desktop[DESKTOP_N]; // 虛擬桌面
 	XModifierKeymap *mod_map; // 功能轉換鍵映射
+    /* 分別爲Caps_Lock、Num_Lock、Scroll_Lock對應的功能轉換鍵掩碼 */
+    unsigned int caps_lock_mask, num_lock_mask, scroll_lock_mask;
+    /* 分別爲按鍵綁定、按鈕綁定的散列索引 */
+    Bind_index *key_index[BIND_INDEX_SIZE], *button_index[BIND_INDEX_SIZE];
+    size_t key_match_max, button_match_max; // 單個按鍵、按鈕事件最多可觸發的綁定數
     Window root_win, resize_win, hint_win; // 根窗口、調整尺寸提示窗口、提示窗口
     GC gc; // 窗口管理器的圖形信息
     Visual *visual; // 着色類型
@@ -269,8 +435,18 @@ struct wm_tag // 窗口管理器相關信息
     Atom ewmh_atom[EWMH_ATOM_N]; // ewmh規範的標識符
     Atom utf8; // utf8字符编码的標識符
     Client *clients; // 頭結點
+    XContext client_ctx, widget_ctx; // 分別爲窗口ID到客戶窗口、構件類型的索引
+    XContext xft_draw_ctx; // 可繪制對象到XftDraw的索引
+    XContext repaint_ctx; // 標記已在重繪隊列中的窗口
+    XContext damage_ctx; // 窗口到其累積的受損（即待重繪的顯露）區域的索引
+    Region draw_clip; // 重繪受損區域時的裁剪區域，爲NULL時表示不裁剪
+    Window *repaints; // 待清除並重繪的窗口隊列
+    size_t repaint_n, repaint_cap; // 分別爲重繪隊列的長度和容量
     Focus_mode focus_mode; // 窗口聚焦模式
     XftFont *font[FONT_N]; // 窗口管理器用到的字體
+    Text_extent_cache text_extents; // 文本寬度緩存
+    Icon_image *icon_images; // 各客戶窗口共享的圖符圖像鏈表
+    Label_pixmap *label_pixmaps[LABEL_PIXMAP_BUCKET_N]; // 靜態標籤像素圖的散列表
     File *wallpapers, *cur_wallpaper; // 壁紙文件列表、当前壁纸文件
     Cursor cursors[POINTER_ACT_N]; // 光標
     Taskbar taskbar; // 任務欄
@@ -279,6 +455,12 @@ struct wm_tag // 窗口管理器相關信息
     XColor widget_color[WIDGET_COLOR_N]; // 構件顏色
     XftColor text_color[TEXT_COLOR_N]; // 文本顏色
     XIM xim;
+    Hover hover; // 定位器懸停的相關信息
+    Timer *timers; // 按到期時刻排序的定時器鏈表
+    int timer_fd, signal_fd; // 分別爲驅動定時器的timerfd、接收信號的signalfd
+    int icon_load_fd; // 加載線程通知圖標加載完成的eventfd，未啓用時爲-1
+    int watch_fd; // 監視壁紙目錄和圖標主題目錄的inotify實例，不可用時爲-1
+    Perf_stat perf_stat; // 性能統計信息
 };
 typedef struct wm_tag WM;
 
@@ -290,14 +472,6 @@ enum direction_tag // 方向
 };
 typedef enum direction_tag Direction;
 
-enum align_type_tag // 文字對齊方式
-{
-    TOP_LEFT, TOP_CENTER, TOP_RIGHT,
-    CENTER_LEFT, CENTER, CENTER_RIGHT,
-    BOTTOM_LEFT, BOTTOM_CENTER, BOTTOM_RIGHT,
-};
-typedef enum align_type_tag Align_type;
-
 union func_arg_tag // 函數參數類型
 {
     bool resize; // 是否調整窗口尺寸
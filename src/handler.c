@@ -9,7 +9,13 @@
  * <http://www.gnu.org/licenses/>。
  * ************************************************************************/
 
+#define _POSIX_C_SOURCE 200809L // 爲了使用clock_gettime
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/signalfd.h>
 #include <time.h>
+#include <unistd.h>
 #include "gwm.h"
 #include "handler.h"
 #include "client.h"
@@ -21,30 +27,33 @@
 #include "icon.h"
 #include "layout.h"
 #include "misc.h"
+#include "timer.h"
+#include "watch.h"
 
+static void handle_signals(WM *wm);
 static void handle_button_press(WM *wm, XEvent *e);
 static void handle_config_request(WM *wm, XEvent *e);
 static void handle_enter_notify(WM *wm, XEvent *e);
 static void handle_pointer_hovers(WM *wm, Window hover, Widget_type type);
-static void handle_pointer_hover(WM *wm, Window hover, void (*handler)(WM *, Window));
+static void begin_hover(WM *wm, Window hover, Widget_type type);
+static void handle_pointer_hover(WM *wm, void *unused);
+static Pointer_act hint_title_bar(WM *wm, Client *c, int x, int y);
+static void handle_motion_notify(WM *wm, XEvent *e);
 static void update_hint_win_for_icon(WM *wm, Window hover);
 static void handle_expose(WM *wm, XEvent *e);
+static void flush_repaints(WM *wm);
+static void redraw_widget(WM *wm, Window win);
 static void handle_key_press(WM *wm, XEvent *e);
 static void handle_leave_notify(WM *wm, XEvent *e);
 static void handle_map_request(WM *wm, XEvent *e);
+static void handle_mapping_notify(WM *wm, XEvent *e);
 static void handle_unmap_notify(WM *wm, XEvent *e);
 static void handle_property_notify(WM *wm, XEvent *e);
 static void handle_wm_transient_for_notify(WM *wm, Client *c, Window win);
 static void handle_selection_notify(WM *wm, XEvent *e);
-static bool is_func_click(WM *wm, Widget_type type, Buttonbind *b, XEvent *e);
 static void focus_clicked_client(WM *wm, Window win);
-static void config_managed_client(WM *wm, Client *c);
 static void config_unmanaged_win(WM *wm, XConfigureRequestEvent *e);
 static void update_icon_text(WM *wm, Window win);
-static void update_taskbar_button_text(WM *wm, size_t index);
-static void update_cmd_center_button_text(WM *wm, size_t index);
-static void update_title_area_text(WM *wm, Client *c);
-static void update_title_button_text(WM *wm, Client *c, size_t index);
 static void update_status_area_text(WM *wm);
 static void key_run_cmd(WM *wm, XKeyEvent *e);
 static void hint_leave_taskbar_button(WM *wm, Widget_type type);
@@ -55,13 +64,71 @@ static void handle_wm_icon_name_notify(WM *wm, Client *c, Window win);
 static void handle_wm_name_notify(WM *wm, Client *c, Window win);
 static void handle_wm_normal_hints_notify(WM *wm, Client *c, Window win);
 
+/* 主循環用poll同時等待X連接、定時器的timerfd、信號的signalfd、圖標加載線程
+ * 的eventfd和監視目錄的inotify，空閑時完全休眠。每次醒來先處理完所有已排隊
+ * 的X事件，再處理延後的工作。 */
 void handle_events(WM *wm)
 {
 	XEvent e;
+    struct pollfd fds[]=
+    {
+        {.fd=ConnectionNumber(wm->display), .events=POLLIN},
+        {.fd=wm->timer_fd, .events=POLLIN},
+        {.fd=wm->signal_fd, .events=POLLIN}, // 爲-1時poll會忽略它
+        {.fd=wm->icon_load_fd, .events=POLLIN},
+        {.fd=wm->watch_fd, .events=POLLIN},
+    };
     XSync(wm->display, False);
-    while(run_flag && !XNextEvent(wm->display, &e))
-        if(!XFilterEvent(&e, None))
-            handle_event(wm, &e);
+    while(run_flag)
+    {
+        while(run_flag && XPending(wm->display))
+        {
+            XNextEvent(wm->display, &e);
+            if(!XFilterEvent(&e, None))
+                handle_event(wm, &e);
+        }
+        handle_deferred_work(wm);
+        /* 延後的工作可能往返X服務器而把事件讀進了隊列，此時不能阻塞 */
+        if(!run_flag || XEventsQueued(wm->display, QueuedAfterFlush))
+            continue;
+        if(poll(fds, ARRAY_NUM(fds), -1) == -1)
+        {
+            if(errno != EINTR)
+                exit_with_perror("poll錯誤");
+        }
+        else
+        {
+            if(fds[2].revents & POLLIN)
+                handle_signals(wm);
+#if USE_IMAGE_ICON
+            if(fds[3].revents & POLLIN)
+                handle_icon_loads(wm);
+#endif
+            if(fds[4].revents & POLLIN)
+                handle_watch_events(wm);
+        }
+    }
+}
+
+/* 處理不必立即響應某個事件的工作，如到期的定時器、布局更新、構件重繪。在
+ * 嵌套的事件循環中，阻塞等待事件之前也應調用它。 */
+void handle_deferred_work(WM *wm)
+{
+    run_timers(wm);
+    flush_layout(wm);
+    flush_repaints(wm);
+}
+
+static void handle_signals(WM *wm)
+{
+    struct signalfd_siginfo si;
+    while(read(wm->signal_fd, &si, sizeof(si)) == sizeof(si))
+    {
+        if(si.ssi_signo == SIGCHLD)
+            clear_zombies(0);
+        else
+            run_flag=0;
+    }
 }
 
 void handle_event(WM *wm, XEvent *e)
@@ -75,6 +142,8 @@ void handle_event(WM *wm, XEvent *e)
         [KeyPress]          = handle_key_press,
         [LeaveNotify]       = handle_leave_notify,
         [MapRequest]        = handle_map_request,
+        [MappingNotify]     = handle_mapping_notify,
+        [MotionNotify]      = handle_motion_notify,
         [UnmapNotify]       = handle_unmap_notify,
         [PropertyNotify]    = handle_property_notify,
         [SelectionNotify]   = handle_selection_notify,
@@ -85,28 +154,22 @@ void handle_event(WM *wm, XEvent *e)
 
 static void handle_button_press(WM *wm, XEvent *e)
 {
-    Buttonbind *b=BUTTONBIND;
+    const Buttonbind *binds[MAX(wm->button_match_max, 1)];
     Widget_type type=get_widget_type(wm, e->xbutton.window);
+    if(SINGLE_WIN_TITLE_BAR && type==TITLE_AREA)
+        type=get_title_bar_widget_type(wm, win_to_client(wm, e->xbutton.window),
+            e->xbutton.x, e->xbutton.y);
+    size_t n=get_buttonbinds(wm, type, e->xbutton.button, e->xbutton.state, binds);
     XUnmapWindow(wm->display, wm->cmd_center.win);
-    for(size_t i=0; i<ARRAY_NUM(BUTTONBIND); i++, b++)
+    for(size_t i=0; i<n; i++)
     {
-        if(is_func_click(wm, type, b, e))
-        {
-            focus_clicked_client(wm, e->xbutton.window);
-            if(b->func)
-                b->func(wm, e, b->arg);
-            if(type == CLIENT_WIN)
-                XAllowEvents(wm->display, ReplayPointer, CurrentTime);
-        }
+        focus_clicked_client(wm, e->xbutton.window);
+        if(binds[i]->func)
+            binds[i]->func(wm, e, binds[i]->arg);
+        if(type == CLIENT_WIN)
+            XAllowEvents(wm->display, ReplayPointer, CurrentTime);
     }
 }
- 
-static bool is_func_click(WM *wm, Widget_type type, Buttonbind *b, XEvent *e)
-{
-    return (b->widget_type == type 
-        && b->button == e->xbutton.button
-        && is_equal_modifier_mask(wm, b->modifier, e->xbutton.state));
-}
 
 static void focus_clicked_client(WM *wm, Window win)
 {
@@ -128,17 +191,6 @@ static void handle_config_request(WM *wm, XEvent *e)
         config_unmanaged_win(wm, &cr);
 }
 
-static void config_managed_client(WM *wm, Client *c)
-{
-    XConfigureEvent ce=
-    {
-        .type=ConfigureNotify, .display=wm->display, .event=c->win,
-        .window=c->win, .x=c->x, .y=c->y, .width=c->w, .height=c->h,
-        .border_width=0, .above=None, .override_redirect=False
-    };
-    XSendEvent(wm->display, c->win, False, StructureNotifyMask, (XEvent *)&ce);
-}
-
 static void config_unmanaged_win(WM *wm, XConfigureRequestEvent *e)
 {
     XWindowChanges wc=
@@ -162,23 +214,18 @@ static void handle_enter_notify(WM *wm, XEvent *e)
         focus_client(wm, wm->cur_desktop, c);
     if(is_layout_adjust_area(wm, win, x))
         act=ADJUST_LAYOUT_RATIO;
-    else if(IS_TASKBAR_BUTTON(type))
-        update_win_background(wm, win,
-            wm->widget_color[ENTERED_NORMAL_BUTTON_COLOR].pixel, None);
+    else if(IS_TASKBAR_BUTTON(type) || IS_CMD_CENTER_ITEM(type))
+        update_label_widget(wm, win, type, ENTERED_NORMAL_BUTTON_COLOR);
     else if(type == CLIENT_ICON)
         update_win_background(wm, win,
             wm->widget_color[ENTERED_NORMAL_BUTTON_COLOR].pixel, None);
-    else if(IS_CMD_CENTER_ITEM(type))
-        update_win_background(wm, win,
-            wm->widget_color[ENTERED_NORMAL_BUTTON_COLOR].pixel, None);
     else if(type == CLIENT_FRAME)
         act=get_resize_act(c, &m);
     else if(type == TITLE_AREA)
-        act=MOVE;
+        act=hint_title_bar(wm, c, e->xcrossing.x, e->xcrossing.y);
     else if(IS_TITLE_BUTTON(type))
-        update_win_background(wm, win, type==CLOSE_BUTTON ?
-            wm->widget_color[ENTERED_CLOSE_BUTTON_COLOR].pixel :
-            wm->widget_color[ENTERED_NORMAL_BUTTON_COLOR].pixel, None);
+        update_label_widget(wm, win, type, type==CLOSE_BUTTON ?
+            ENTERED_CLOSE_BUTTON_COLOR : ENTERED_NORMAL_BUTTON_COLOR);
     XDefineCursor(wm->display, win, wm->cursors[act]);
     handle_pointer_hovers(wm, win, type);
 }
@@ -186,35 +233,74 @@ static void handle_enter_notify(WM *wm, XEvent *e)
 static void handle_pointer_hovers(WM *wm, Window hover, Widget_type type)
 {
     if(type == CLIENT_ICON)
-        handle_pointer_hover(wm, hover, update_hint_win_for_icon);
+        begin_hover(wm, hover, type);
+}
+
+static void begin_hover(WM *wm, Window hover, Widget_type type)
+{
+    Hover *h=&wm->hover;
+    cancel_hover(wm);
+    h->win=hover, h->type=type;
+    clock_gettime(CLOCK_MONOTONIC, &h->time);
+    h->timer=add_timer(wm, HOVER_TIME*100, handle_pointer_hover, NULL);
 }
 
-static void handle_pointer_hover(WM *wm, Window hover, void (*handler)(WM *, Window))
+void cancel_hover(WM *wm)
 {
-    XEvent ev;
-    bool pause=false;
-    unsigned int diff_time; // 單位爲分秒，即十分之一秒
-    clock_t last_time=clock();
-    while(1)
+    Hover *h=&wm->hover;
+    if(h->is_shown)
+        XUnmapWindow(wm->display, wm->hint_win);
+    if(h->timer)
+        del_timer(wm, h->timer);
+    h->win=None, h->timer=NULL, h->is_shown=false;
+}
+
+/* 定位器移動時只更新時刻而不重設定時器，到期時再據此判斷是否需要順延 */
+static void handle_pointer_hover(WM *wm, void *unused)
+{
+    Hover *h=&wm->hover;
+    long ms=get_remaining_ms(&h->time, HOVER_TIME*100);
+    if(ms)
+        h->timer=add_timer(wm, ms, handle_pointer_hover, NULL);
+    else
     {
-        if(XCheckMaskEvent(wm->display, ROOT_EVENT_MASK|PointerMotionMask, &ev))
+        h->timer=NULL, h->is_shown=true;
+        if(h->type == CLIENT_ICON)
+            update_hint_win_for_icon(wm, h->win);
+    }
+}
+
+/* 單窗口標題欄模式下，按定位器所在的標題欄構件更新懸停效果，並返回相應
+ * 的定位器操作 */
+static Pointer_act hint_title_bar(WM *wm, Client *c, int x, int y)
+{
+    if(!SINGLE_WIN_TITLE_BAR)
+        return MOVE;
+    Widget_type type=get_title_bar_widget_type(wm, c, x, y);
+    update_title_hover(wm, c, type);
+    return type==TITLE_AREA ? MOVE : NO_OP;
+}
+
+static void handle_motion_notify(WM *wm, XEvent *e)
+{
+    Hover *h=&wm->hover;
+    Window win=e->xmotion.window;
+    if(SINGLE_WIN_TITLE_BAR && get_widget_type(wm, win)==TITLE_AREA)
+    {
+        Client *c=win_to_client(wm, win);
+        Widget_type old=c->title_hover;
+        Pointer_act act=hint_title_bar(wm, c, e->xmotion.x, e->xmotion.y);
+        if(c->title_hover != old)
+            XDefineCursor(wm->display, win, wm->cursors[act]);
+    }
+    if(e->xmotion.window == h->win)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &h->time);
+        if(h->is_shown)
         {
-            handle_event(wm, &ev);
-            if(ev.type == MotionNotify && ev.xmotion.window==hover)
-            {
-                last_time=clock();
-                XUnmapWindow(wm->display, wm->hint_win);
-                pause=false;
-            }
-            else if(ev.type==LeaveNotify && ev.xcrossing.window==hover)
-            {
-                XUnmapWindow(wm->display, wm->hint_win);
-                break;
-            }
+            XUnmapWindow(wm->display, wm->hint_win), h->is_shown=false;
+            h->timer=add_timer(wm, HOVER_TIME*100, handle_pointer_hover, NULL);
         }
-        diff_time=10*(clock()-last_time)/CLOCKS_PER_SEC;
-        if(!pause && diff_time>=HOVER_TIME)
-            handler(wm, hover), pause=true;
     }
 }
 
@@ -240,25 +326,43 @@ static void update_hint_win_for_icon(WM *wm, Window hover)
     }
 }
 
+/* 把顯露的矩形累積到窗口的受損區域中，收到同一批的最後一個顯露事件時，
+ * 再以該區域爲裁剪區域重繪構件，故局部遮擋變化的重繪代價與受損面積相當 */
 static void handle_expose(WM *wm, XEvent *e)
 {
-    if(e->xexpose.count)
-        return;
-    Window win=e->xexpose.window;
+    XExposeEvent *ee=&e->xexpose;
+    XRectangle r={ee->x, ee->y, ee->width, ee->height};
+    add_damage(wm, ee->window, &r);
+    if(ee->count == 0)
+    {
+        Region damage=take_damage(wm, ee->window);
+        XSetRegion(wm->display, wm->gc, damage);
+        wm->draw_clip=damage;
+        redraw_widget(wm, ee->window);
+        wm->draw_clip=NULL;
+        XSetClipMask(wm->display, wm->gc, None);
+        XDestroyRegion(damage);
+    }
+}
+
+/* 在本進程內直接清除並重繪因改變背景色而加入重繪隊列的構件 */
+static void flush_repaints(WM *wm)
+{
+    Window win;
+    while(get_repaint(wm, &win))
+    {
+        XClearWindow(wm->display, win);
+        redraw_widget(wm, win);
+    }
+}
+
+static void redraw_widget(WM *wm, Window win)
+{
     Widget_type type=get_widget_type(wm, win);
     if(type == CLIENT_ICON)
         update_icon_text(wm, win);
-    else if(IS_TASKBAR_BUTTON(type))
-        update_taskbar_button_text(wm, TASKBAR_BUTTON_INDEX(type));
-    else if(IS_CMD_CENTER_ITEM(type))
-        update_cmd_center_button_text(wm, CMD_CENTER_ITEM_INDEX(type));
     else if(type == STATUS_AREA)
         update_status_area_text(wm);
-    else if(type == TITLE_AREA)
-        update_title_area_text(wm, win_to_client(wm, win));
-    else if(IS_TITLE_BUTTON(type))
-        update_title_button_text(wm, win_to_client(wm, win),
-            TITLE_BUTTON_INDEX(type));
     else if(type == RUN_CMD_ENTRY)
         update_entry_text(wm, &wm->run_cmd);
 }
@@ -280,43 +384,6 @@ static void update_icon_text(WM *wm, Window win)
     }
 }
 
-static void update_taskbar_button_text(WM *wm, size_t index)
-{
-    String_format f={{0, 0, TASKBAR_BUTTON_WIDTH, TASKBAR_BUTTON_HEIGHT},
-        CENTER, false, 0, wm->text_color[TASKBAR_BUTTON_TEXT_COLOR],
-        TASKBAR_BUTTON_FONT};
-    draw_string(wm, wm->taskbar.buttons[index], TASKBAR_BUTTON_TEXT[index], &f);
-}
-
-static void update_cmd_center_button_text(WM *wm, size_t index)
-{
-    String_format f={{0, 0, CMD_CENTER_ITEM_WIDTH, CMD_CENTER_ITEM_HEIGHT},
-        CENTER_LEFT, false, 0, wm->text_color[CMD_CENTER_ITEM_TEXT_COLOR],
-        CMD_CENTER_FONT};
-    draw_string(wm, wm->cmd_center.items[index], CMD_CENTER_ITEM_TEXT[index], &f);
-}
-
-static void update_title_area_text(WM *wm, Client *c)
-{
-    if(c->title_bar_h)
-    {
-        String_format f={get_title_area_rect(wm, c), CENTER_LEFT, false, 0,
-            wm->text_color[TITLE_AREA_TEXT_COLOR], TITLE_AREA_FONT};
-        draw_string(wm, c->title_area, c->title_text, &f);
-    }
-}
-
-static void update_title_button_text(WM *wm, Client *c, size_t index)
-{
-    if(c->title_bar_h)
-    {
-        String_format f={{0, 0, TITLE_BUTTON_WIDTH, TITLE_BUTTON_HEIGHT},
-            CENTER, false, 0, wm->text_color[TITLE_BUTTON_TEXT_COLOR],
-            TITLE_BUTTON_FONT};
-        draw_string(wm, c->buttons[index], TITLE_BUTTON_TEXT[index], &f);
-    }
-}
-
 static void update_status_area_text(WM *wm)
 {
     Taskbar *b=&wm->taskbar;
@@ -331,18 +398,11 @@ static void handle_key_press(WM *wm, XEvent *e)
         key_run_cmd(wm, &e->xkey);
     else
     {
-        int n;
-        KeySym *ks=XGetKeyboardMapping(wm->display, e->xkey.keycode, 1, &n);
-        Keybind *p=KEYBIND;
-
-        for(size_t i=0; i<ARRAY_NUM(KEYBIND); i++, p++)
-        {
-            if( *ks == p->keysym
-                && is_equal_modifier_mask(wm, p->modifier, e->xkey.state)
-                && p->func)
-                p->func(wm, e, p->arg);
-        }
-        XFree(ks);
+        const Keybind *binds[MAX(wm->key_match_max, 1)];
+        size_t n=get_keybinds(wm, e->xkey.keycode, e->xkey.state, binds);
+        for(size_t i=0; i<n; i++)
+            if(binds[i]->func)
+                binds[i]->func(wm, e, binds[i]->arg);
     }
 }
 
@@ -360,31 +420,32 @@ static void handle_leave_notify(WM *wm, XEvent *e)
 {
     Window win=e->xcrossing.window;
     Widget_type type=get_widget_type(wm, win);
+    if(win == wm->hover.win)
+        cancel_hover(wm);
     if(IS_TASKBAR_BUTTON(type))
         hint_leave_taskbar_button(wm, type);
     else if(type == CLIENT_ICON)
         update_win_background(wm, win, wm->widget_color[ICON_AREA_COLOR].pixel, None);
     else if(IS_CMD_CENTER_ITEM(type))
-        update_win_background(wm, win, wm->widget_color[CMD_CENTER_COLOR].pixel, None);
+        update_label_widget(wm, win, type, CMD_CENTER_COLOR);
     else if(IS_TITLE_BUTTON(type))
         hint_leave_title_button(wm, win_to_client(wm, win), type);
+    else if(SINGLE_WIN_TITLE_BAR && type==TITLE_AREA)
+        update_title_hover(wm, win_to_client(wm, win), TITLE_AREA);
 }
 
 static void hint_leave_taskbar_button(WM *wm, Widget_type type)
 {
-    unsigned long color = is_chosen_button(wm, type) ?
-        wm->widget_color[CHOSEN_TASKBAR_BUTTON_COLOR].pixel :
-        wm->widget_color[NORMAL_TASKBAR_BUTTON_COLOR].pixel ;
     Window win=wm->taskbar.buttons[TASKBAR_BUTTON_INDEX(type)];
-    update_win_background(wm, win, color, None);
+    update_label_widget(wm, win, type, is_chosen_button(wm, type) ?
+        CHOSEN_TASKBAR_BUTTON_COLOR : NORMAL_TASKBAR_BUTTON_COLOR);
 }
 
 static void hint_leave_title_button(WM *wm, Client *c, Widget_type type)
 {
     Window win=c->buttons[TITLE_BUTTON_INDEX(type)];
-    update_win_background(wm, win, c==DESKTOP(wm).cur_focus_client ?
-        wm->widget_color[CURRENT_TITLE_BUTTON_COLOR].pixel :
-        wm->widget_color[NORMAL_TITLE_BUTTON_COLOR].pixel, None);
+    update_label_widget(wm, win, type, c==DESKTOP(wm).cur_focus_client ?
+        CURRENT_TITLE_BUTTON_COLOR : NORMAL_TITLE_BUTTON_COLOR);
 }
 
 static void handle_map_request(WM *wm, XEvent *e)
@@ -399,6 +460,20 @@ static void handle_map_request(WM *wm, XEvent *e)
     }
 }
 
+/* 鍵盤或功能轉換鍵映射變化後，要重新計算鎖定鍵的掩碼並重新獨享按鍵和按鈕 */
+static void handle_mapping_notify(WM *wm, XEvent *e)
+{
+    XMappingEvent *me=&e->xmapping;
+    if(me->request==MappingKeyboard || me->request==MappingModifier)
+    {
+        XRefreshKeyboardMapping(me);
+        update_modifier_masks(wm);
+        grab_keys(wm);
+        for(Client *c=wm->clients->next; c!=wm->clients; c=c->next)
+            grab_buttons(wm, c);
+    }
+}
+
 /* 對已經映射的窗口重設父窗口會依次執行以下操作：
  *     1、自動解除映射該窗口，原父窗口可以收到该UnmapNotify事件；
  *     2、把該窗口從窗口層次結構中移走；
@@ -475,7 +550,7 @@ static void handle_wm_name_notify(WM *wm, Client *c, Window win)
         {
             free(c->title_text);
             c->title_text=s;
-            update_title_area_text(wm, c);
+            update_title_area(wm, c, c->is_title_pixmap_focused, true);
         }
         else if(win == wm->root_win)
         {
@@ -14,5 +14,7 @@
 
 void handle_events(WM *wm);
 void handle_event(WM *wm, XEvent *e);
+void handle_deferred_work(WM *wm);
+void cancel_hover(WM *wm);
 
 #endif
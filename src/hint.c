@@ -37,27 +37,34 @@ void update_size_hint(WM *wm, Client *c)
 {
     long flags;
     XSizeHints hint={0};
+    bool has_hint=XGetWMNormalHints(wm->display, c->win, &hint, &flags);
+    set_size_hint(c, has_hint ? &hint : NULL);
+}
 
-    if(XGetWMNormalHints(wm->display, c->win, &hint, &flags))
+/* 修正並設置已讀取的窗口尺寸特性，hint爲NULL時只保證增量有效 */
+void set_size_hint(Client *c, const XSizeHints *hint)
+{
+    if(hint)
     {
+        XSizeHints h=*hint;
         unsigned int basew=0, baseh=0, minw=0, minh=0;
-        if(hint.flags & PBaseSize)
-            basew=hint.base_width, baseh=hint.base_height;
-        if(hint.flags & PMinSize)
-            minw=hint.min_width, minh=hint.min_height;
+        if(h.flags & PBaseSize)
+            basew=h.base_width, baseh=h.base_height;
+        if(h.flags & PMinSize)
+            minw=h.min_width, minh=h.min_height;
         if(!basew && minw)
-            hint.base_width=minw;
+            h.base_width=minw;
         if(!baseh && minh)
-            hint.base_height=minh;
+            h.base_height=minh;
         if(!minw && basew)
-            hint.min_width=basew;
+            h.min_width=basew;
         if(!minh && baseh)
-            hint.min_height=baseh;
-        if(!hint.width_inc)
-            hint.width_inc=MOVE_RESIZE_INC;
-        if(!hint.height_inc)
-            hint.height_inc=MOVE_RESIZE_INC;
-        c->size_hint=hint;
+            h.min_height=baseh;
+        if(!h.width_inc)
+            h.width_inc=MOVE_RESIZE_INC;
+        if(!h.height_inc)
+            h.height_inc=MOVE_RESIZE_INC;
+        c->size_hint=h;
     }
     SET_DEF_VAL(c->size_hint.width_inc, MOVE_RESIZE_INC);
     SET_DEF_VAL(c->size_hint.height_inc, MOVE_RESIZE_INC);
@@ -120,7 +127,7 @@ bool is_prefer_aspect(unsigned int w, unsigned int h, XSizeHints *hint)
 
 void set_input_focus(WM *wm, XWMHints *hint, Window win)
 {
-    if(!hint || (hint->flags & InputHint) || hint->input)
+    if(!hint || !(hint->flags & InputHint) || hint->input)
         XSetInputFocus(wm->display, win, RevertToPointerRoot, CurrentTime);
     send_event(wm, wm->icccm_atoms[WM_TAKE_FOCUS], win);
 }
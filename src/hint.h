@@ -15,6 +15,7 @@
 unsigned int get_client_col(WM *wm, Client *c);
 unsigned int get_client_row(WM *wm, Client *c);
 void update_size_hint(WM *wm, Client *c);
+void set_size_hint(Client *c, const XSizeHints *hint);
 bool is_prefer_resize(WM *wm, Client *c, Delta_rect *d);
 bool is_prefer_size(unsigned int w, unsigned int h, XSizeHints *hint);
 bool is_prefer_aspect(unsigned int w, unsigned int h, XSizeHints *hint);
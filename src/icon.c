@@ -13,388 +13,336 @@
 #include "client.h"
 #include "desktop.h"
 #include "font.h"
+#include "handler.h"
 #include "icon.h"
+#include "icon_loader.h"
 #include "misc.h"
 
 #if USE_IMAGE_ICON
 
-// 存儲圖標主題規範所說的Per-Directory Keys的結構
-struct icon_dir_info_tag
-{
-    int size, scale, max_size, min_size, threshold;
-    char type[10]; // char context[32]; 目前用不上
-};
-typedef struct icon_dir_info_tag Icon_dir_info;
-
 static void draw_icon_image(WM *wm, Client *c);
-static void draw_image(WM *wm, Imlib_Image image, Drawable d, int x, int y, unsigned int w, unsigned int h);
 static void set_icon_image(WM *wm, Client *c);
-static Imlib_Image get_icon_image_from_hint(WM *wm, Client *c);
-static Imlib_Image get_icon_image_from_prop(WM *wm, Client *c);
-static Imlib_Image get_icon_image_from_file(WM *wm, Client *c);
-static char *find_icon(const char *name, int size, int scale, const char *context_dir);
-static char *find_icon_helper(const char *name, int size, int scale, char *const *base_dirs, const char *theme, const char *context_dir);
-static char *lookup_icon(const char *name, int size, int scale, char *const *base_dirs, const char *theme, const char *context_dir);
-static char *lookup_fallback_icon(const char *name, char *const *base_dirs);
-static bool is_dir_match_size(const char *base_dir, const char *theme, const char *sub_dir, int size, int scale);
-static int get_dir_size_distance(const char *base_dir, const char *theme, const char *sub_dir, int size, int scale);
-static char **get_base_dirs(void);
-static char **get_sub_dirs(const char *base_dir, const char *theme, const char *context_dir);
-static char **get_list_val_from_index_theme(const char *base_dir, const char *theme, const char *key, const char *filter);
-static char *grep_index_theme(const char *base_dir, const char *theme, const char *key, char *buf, size_t size);
-static bool get_dir_info_from_index_theme(const char *base_dir, const char *theme, const char *sub_dir, Icon_dir_info *info);
-static bool get_icon_dir_info_from_buf(char *buf, size_t size, Icon_dir_info *info);
-static void fix_icon_dir_info(Icon_dir_info *info);
-static FILE *open_index_theme(const char *base_dir, const char *theme);
-static size_t get_spec_char_num(const char *str, int ch);
-static char **get_parent_themes(const char *base_dir, const char *theme);
-static bool is_accessible(const char *filename);
-
+static Icon_image *get_icon_image(WM *wm, Client *c, Icon_source source, unsigned long id, const char *name);
+static Icon_image *find_icon_image(WM *wm, Icon_source source, unsigned long id, const char *name, unsigned int size);
+static Icon_image *add_icon_image(WM *wm, Icon_source source, unsigned long id, const char *name);
+static void create_icon_pixmaps(WM *wm, Icon_image *p, const DATA32 *data);
+static unsigned long get_pixel_from_argb(Visual *v, DATA32 argb);
+static DATA32 get_argb_from_pixel(Visual *v, unsigned long pixel, unsigned int depth);
+static DATA32 *get_icon_data_from_hint(WM *wm, Client *c, unsigned int *w, unsigned int *h);
+static DATA32 *get_icon_data_from_prop(WM *wm, Client *c, unsigned int *w, unsigned int *h);
+static bool is_better_icon_size(unsigned long size, unsigned long best);
+static void narrow_argb(DATA32 *restrict dst, const unsigned long *restrict src, size_t n);
+
+/* 圖符已預先縮放爲X服務器端的像素圖，重繪時只需按形狀掩碼復制過去 */
 static void draw_icon_image(WM *wm, Client *c)
 {
-    if(c && c->icon && c->image)
-        draw_image(wm, c->image, c->icon->win, 0, 0, ICON_SIZE, ICON_SIZE);
-}
-
-static void draw_image(WM *wm, Imlib_Image image, Drawable d, int x, int y, unsigned int w, unsigned int h)
-{
-    imlib_context_set_image(image);
-    imlib_context_set_drawable(d);   
-    imlib_render_image_on_drawable_at_size(x, y, w, h);
+    if( !c || !c->icon || !c->icon_image || !c->icon_image->pixmap
+        || is_clipped_out(wm, 0, 0, ICON_SIZE, ICON_SIZE))
+        return;
+    Icon_image *i=c->icon_image;
+    if(i->mask)
+        XSetClipMask(wm->display, wm->gc, i->mask);
+    XCopyArea(wm->display, i->pixmap, c->icon->win, wm->gc,
+        0, 0, i->size, i->size, 0, 0);
+    if(i->mask) // 恢復重繪受損區域時的裁剪區域
+    {
+        if(wm->draw_clip)
+            XSetRegion(wm->display, wm->gc, wm->draw_clip);
+        else
+            XSetClipMask(wm->display, wm->gc, None);
+    }
 }
 
 static void set_icon_image(WM *wm, Client *c)
 {
+    if(!c || c->icon_image)
+        return;
     /* 根據加載效率依次嘗試 */
-    if( c && !c->image
-        && !( (c->image=get_icon_image_from_hint(wm, c))
-        || (c->image=get_icon_image_from_prop(wm, c))
-        || (c->image=get_icon_image_from_file(wm, c))))
-        c->image=NULL;
+    XWMHints *h=c->wm_hint;
+    if(h && (h->flags & IconPixmapHint))
+        c->icon_image=get_icon_image(wm, c, ICON_FROM_HINT, h->icon_pixmap, NULL);
+    if(!c->icon_image)
+        c->icon_image=get_icon_image(wm, c, ICON_FROM_PROP, 0, c->class_hint.res_class);
+    if(!c->icon_image)
+        c->icon_image=get_icon_image(wm, c, ICON_FROM_FILE, 0, c->class_hint.res_name);
 }
 
-static Imlib_Image get_icon_image_from_hint(WM *wm, Client *c)
+/* 按(來源, 鍵值, 尺寸)查找共享的圖符圖像，找到則增加其引用計數；否則交給加
+ * 載線程縮放，在此之前圖像的像素圖爲None，縮微窗口暫時顯示程序類型名。圖標
+ * 文件的搜索和解碼也由加載線程完成；WM_HINTS和_NET_WM_ICON的圖像則在此讀
+ * 出像素數據，讀不到時返回NULL，以便改用下一種來源。原圖像（如_NET_WM_ICON）
+ * 往往比圖符大得多，縮放後即釋放，不必常駐內存。 */
+static Icon_image *get_icon_image(WM *wm, Client *c, Icon_source source, unsigned long id, const char *name)
 {
-    if(c->wm_hint && (c->wm_hint->flags & IconPixmapHint))
+    if(source==ICON_FROM_PROP && !name)
+        id=c->win;
+    Icon_image *p=find_icon_image(wm, source, id, name, ICON_SIZE);
+    if(p)
+        return p->refs++, p;
+
+    if(source == ICON_FROM_FILE)
     {
-        unsigned int w, h, d;
-        Pixmap pixmap=c->wm_hint->icon_pixmap, mask=c->wm_hint->icon_mask;
-        if(!get_geometry(wm, pixmap, &w, &h, &d))
+        if(!name)
             return NULL;
-        imlib_context_set_drawable(pixmap);   
-        return imlib_create_image_from_drawable(mask, 0, 0, w, h, 0);
+        request_icon_load(name, ICON_SIZE);
+        return add_icon_image(wm, source, id, name);
     }
-    return NULL;
-}
 
-static Imlib_Image get_icon_image_from_prop(WM *wm, Client *c)
-{
-    unsigned long i, n=0, w=0, h=0, *data=NULL;
-    unsigned char *p=get_prop(wm, c->win, wm->ewmh_atom[_NET_WM_ICON], &n);
-    if(!p)
+    unsigned int w=0, h=0;
+    DATA32 *data = source==ICON_FROM_HINT ?
+        get_icon_data_from_hint(wm, c, &w, &h) : get_icon_data_from_prop(wm, c, &w, &h);
+    if(!data)
         return NULL;
-    
-    data=(unsigned long *)p;
-    w=data[0], h=data[1], data+=2;
-    Imlib_Image image=imlib_create_image(w, h);
-    imlib_context_set_image(image);
-    imlib_image_set_has_alpha(1);
-    /* imlib2和_NET_WM_ICON同樣使用大端字節序，因此不必轉換字節序 */
-    DATA32 *image_data=imlib_image_get_data();
-    /* 當long大小爲8字節時，以long型數組存儲的特性數據，每個元素的前4字節都是填充0 */
-    if(sizeof(long) == 8)
-        for(i=0; i<n; i++)
-            image_data[i]=data[i]; // 跳過填充字節
-    else
-        memcpy(image_data, (unsigned char *)data, w*h*4);
-    XFree(p);
-    imlib_image_put_back_data(image_data);
-    return image;
-}
-
-static Imlib_Image get_icon_image_from_file(WM *wm, Client *c)
-{
-    char *filename=find_icon(c->class_hint.res_name, ICON_SIZE, 1, "apps");
-    return filename ? imlib_load_image(filename) : NULL;
+    request_icon_scale(source, id, name, w, h, data, ICON_SIZE);
+    return add_icon_image(wm, source, id, name);
 }
 
-/* 根據圖標名稱、尺寸、縮放比例和規範中context對應的目錄名來搜索圖標文件全名。
- * context_dir的取值參見以下規範中的Directory列：
- * specifications.freedesktop.org/icon-naming-spec/icon-naming-spec-latest.html
- * 當context_dir爲空指針時，即爲通配。
- * 以下尋找圖標文件的算法參考《圖標主題規範》(以下簡稱規範，詳見：
- * specifications.freedesktop.org/icon-theme-spec/icon-theme-spec-latest.html) 
- * ，並修正其謬誤，及提高效率。規範對index.theme的格式提出詳細要求，實際上我所
- * 見過的所有這類文件都沒有不必要的空白符。爲簡單起見，本搜索圖標文件的算法也不
- * 考慮其存在多餘空白符。*/
-
-#define ICON_BUF_SIZE (1<<20)
-// 目前圖標主題規範只支持這三種格式的圖標
-#define ICON_EXT (const char *[]){".png", ".svg", ".xpm"}
-// index.theme文件中的目錄段鍵名，即圖標主題規範所說的Per-Directory Keys
-#define ICON_THEME_PER_DIR_KEYS (const char *[]){"Size=", "Scale=", "MaxSize=", "MinSize=", "Threshold=", "Type=", "Context="}
-
-static char *find_icon(const char *name, int size, int scale, const char *context_dir)
+static Icon_image *find_icon_image(WM *wm, Icon_source source, unsigned long id, const char *name, unsigned int size)
 {
-    char *filename=NULL, **base_dirs=get_base_dirs();
-
-    // 規範建議先找基本目錄，然後找hicolor，最後找後備目錄
-    if( (filename=find_icon_helper(name, size, scale, base_dirs, CUR_ICON_THEME, context_dir))
-        || (filename=find_icon_helper(name, size, scale, base_dirs, "hicolor", context_dir))
-        || (filename=lookup_fallback_icon(name, base_dirs)))
-    {
-        for(char **b=base_dirs; b&&*b; b++)
-            free(*b);
-        free((void *)base_dirs);
-    }
-    return filename;
-}
-
-static char *find_icon_helper(const char *name, int size, int scale, char *const *base_dirs, const char *theme, const char *context_dir)
-{
-    char *filename=NULL, *const *b=NULL, *const *p=NULL, *const *backup=NULL;
-
-    if((filename=lookup_icon(name, size, scale, base_dirs, theme, context_dir)))
-        return filename;
-    // 規範建議在給定主題中找不到匹配的圖標時，遞歸搜索其父主題列表
-    for(b=base_dirs; b&&*b; b++, free((void *)backup))
-        for(backup=p=get_parent_themes(*b, theme); p&&*p; free(*p++))
-            if((filename=find_icon_helper(name, size, scale, b, *p, context_dir)))
-                { free((void *)backup); return filename; }
-    return NULL;
-}
-
-static char *lookup_icon(const char *name, int size, int scale, char *const *base_dirs, const char *theme, const char *context_dir)
-{
-    int min=INT_MAX, d=0;
-    char *filename=NULL, *closest_filename=NULL;
-    char *const *b=NULL, *const *s=NULL, *const *backup=NULL;
-
-    // 規範建議先搜索完全匹配的圖標，然後搜索尺寸最接近的圖標
-    for(b=base_dirs; b&&*b; b++, free((void *)backup))
-        for(backup=s=get_sub_dirs(*b, theme, context_dir); s&&*s; free(*s++))
-            for(size_t i=0, n=ARRAY_NUM(ICON_EXT); i<n; i++)
-                if(is_accessible(filename=copy_strings(*b, "/", theme, "/",
-                    *s, "/", name, ICON_EXT[i], NULL)))
-                {
-                    if(is_dir_match_size(*b, theme, *s, size, scale))
-                        { free((void *)backup); return filename; }
-                    if((d=get_dir_size_distance(*b, theme, *s, size, scale)) < min)
-                        closest_filename=filename, min=d;
-                }
-    if(closest_filename)
-        return closest_filename;
+    if(!id && !name) // 無鍵值的圖像不能共享
+        return NULL;
+    for(Icon_image *p=wm->icon_images; p; p=p->next)
+        if( p->source==source && p->id==id && p->size==size
+            && (name ? p->name && !strcmp(p->name, name) : !p->name))
+            return p;
     return NULL;
 }
 
-static char *lookup_fallback_icon(const char *name, char *const *base_dirs)
+static Icon_image *add_icon_image(WM *wm, Icon_source source, unsigned long id, const char *name)
 {
-    char *filename=NULL;
-    // 規範規定後備圖標路徑爲：基本目錄/圖標名.擴展名
-    for(char *const *b=base_dirs; b&&*b; b++)
-        for(size_t i=0, n=ARRAY_NUM(ICON_EXT); i<n; i++)
-            if((filename=copy_strings(*b, "/", name, ICON_EXT[i], NULL))
-                && is_accessible(filename))
-                return filename;
-    return NULL;
+    Icon_image *p=malloc_s(sizeof(Icon_image));
+    *p=(Icon_image){source, id, name ? copy_string(name) : NULL, ICON_SIZE, 1,
+        None, None, wm->icon_images};
+    return wm->icon_images=p;
 }
 
-static bool is_dir_match_size(const char *base_dir, const char *theme, const char *sub_dir, int size, int scale)
+/* 把加載線程已縮放的圖像生成像素圖，並重繪使用它的縮微窗口。若加載完成前使
+ * 用該圖像的客戶窗口都已刪除，則丟棄加載結果。 */
+void handle_icon_loads(WM *wm)
 {
-    Icon_dir_info info;
-    if( !get_dir_info_from_index_theme(base_dir, theme, sub_dir, &info)
-        || info.scale != scale)
-        return false;
-    if(strcmp(info.type, "Fixed") == 0)
-        return info.size==size;
-    if(strcmp(info.type, "Scaled") == 0)
-        return info.min_size<=size && size<=info.max_size;
-    if(strcmp(info.type, "Threshold") == 0)
-        return info.size-info.threshold<=size && size<=info.size+info.threshold;
-    return false;
+    for(Icon_load *l=get_icon_load(); l; free_icon_load(l), l=get_icon_load())
+    {
+        Icon_image *p=find_icon_image(wm, l->source, l->id, l->name, l->size);
+        if(!p || p->pixmap || !l->data)
+            continue;
+
+        create_icon_pixmaps(wm, p, l->data);
+        for(Client *c=wm->clients->next; c!=wm->clients; c=c->next)
+            if(c->icon_image==p && c->icon)
+                add_repaint(wm, c->icon->win);
+    }
 }
 
-static int get_dir_size_distance(const char *base_dir, const char *theme, const char *sub_dir, int size, int scale)
+/* 直接用Xlib把ARGB像素數據轉換爲像素圖及其形狀掩碼，不使用imlib2，故主循環
+ * 不必與加載線程爭用imlib的鎖。同imlib2，不透明度不小於一半的像素才屬於形狀，
+ * 完全不透明的圖像不需要掩碼。 */
+static void create_icon_pixmaps(WM *wm, Icon_image *p, const DATA32 *data)
 {
-    Icon_dir_info info;
-    if(!get_dir_info_from_index_theme(base_dir, theme, sub_dir, &info))
-        return 0;
-    if(strcmp(info.type, "Fixed") == 0)
-        return abs(info.size*info.scale-size*scale);
-    if(strcmp(info.type, "Scaled") == 0)
+    Display *d=wm->display;
+    unsigned int n=p->size, depth=DefaultDepth(d, wm->screen);
+    XImage *image=XCreateImage(d, wm->visual, depth, ZPixmap, 0, NULL, n, n, 32, 0),
+           *mask=XCreateImage(d, wm->visual, 1, ZPixmap, 0, NULL, n, n, 32, 0);
+    if(!image || !mask)
     {
-        if(size*scale < info.min_size*info.scale)
-            return info.min_size*info.scale-size*scale;
-        if(size*scale > info.max_size*info.scale)
-            return size*scale-info.max_size*info.scale;
-        return 0;
+        if(image)
+            XDestroyImage(image);
+        if(mask)
+            XDestroyImage(mask);
+        return;
     }
-    if(strcmp(info.type, "threshold") == 0)
+
+    bool has_mask=false;
+    image->data=malloc_s(image->bytes_per_line*n);
+    mask->data=malloc_s(mask->bytes_per_line*n);
+    for(unsigned int y=0; y<n; y++)
     {
-        if(size*scale < (info.size-info.threshold)*info.scale)
-            return info.min_size*info.scale-size*scale;
-        if(size*scale > (info.size+info.threshold)*info.scale)
-            return size*scale-info.max_size*info.scale;
-        return 0;
+        for(unsigned int x=0; x<n; x++)
+        {
+            DATA32 argb=data[y*n+x];
+            bool is_opaque = argb>>24 >= 0x80;
+            XPutPixel(image, x, y, get_pixel_from_argb(wm->visual, argb));
+            XPutPixel(mask, x, y, is_opaque);
+            has_mask = has_mask || !is_opaque;
+        }
     }
-    return INT_MAX;
-}
 
-static char **get_base_dirs(void)
-{
-    char **dirs=NULL, *home=getenv("HOME"), *pix="/usr/share/pixmaps",
-          *xdg=copy_strings(getenv("XDG_DATA_DIRS"), NULL);
-    int n=get_spec_char_num(xdg, ':')+4;
-
-    // 規範規定依次搜索如下三個基本目錄：
-    // $HOME/.icons、$XDG_DATA_DIRS/icons、/usr/share/pixmaps
-    dirs=malloc(n*sizeof(char *));
-    dirs[0]=copy_strings(home, "/.icons", NULL);
-    dirs[n-2]=copy_strings(pix, NULL);
-    dirs[n-1]=NULL;
-    for(size_t len=0, i=1; i<n-2; i++, xdg+=len+1)
+    p->pixmap=XCreatePixmap(d, wm->root_win, n, n, depth);
+    GC gc=XCreateGC(d, p->pixmap, 0, NULL);
+    XPutImage(d, p->pixmap, gc, image, 0, 0, 0, 0, n, n);
+    XFreeGC(d, gc);
+    if(has_mask)
     {
-        xdg[len=strcspn(xdg, ":")]='\0';
-        dirs[i]=copy_strings(xdg, "/icons", NULL);
+        p->mask=XCreatePixmap(d, wm->root_win, n, n, 1);
+        gc=XCreateGC(d, p->mask, 0, NULL);
+        XPutImage(d, p->mask, gc, mask, 0, 0, 0, 0, n, n);
+        XFreeGC(d, gc);
     }
-    return dirs;
+    XDestroyImage(image);
+    XDestroyImage(mask);
 }
 
-static char **get_sub_dirs(const char *base_dir, const char *theme, const char *context_dir)
+/* 按真彩色視覺類型的各顏色掩碼在像素值與ARGB之間轉換。1位深的位圖中1爲前景
+ * （黑色），0爲背景（白色）。 */
+static unsigned long get_pixel_from_argb(Visual *v, DATA32 argb)
 {
-    return get_list_val_from_index_theme(base_dir, theme, "Directories=", context_dir);
+    unsigned long masks[]={v->red_mask, v->green_mask, v->blue_mask}, pixel=0;
+    for(size_t i=0; i<ARRAY_NUM(masks); i++)
+    {
+        unsigned long m=masks[i], c=argb>>(16-8*i) & 0xff;
+        int shift=0;
+        for(; m && !(m&1); m>>=1)
+            shift++;
+        pixel |= (c*m/0xff) << shift;
+    }
+    return pixel;
 }
 
-static char **get_list_val_from_index_theme(const char *base_dir, const char *theme, const char *key, const char *filter)
+static DATA32 get_argb_from_pixel(Visual *v, unsigned long pixel, unsigned int depth)
 {
-    char buf[ICON_BUF_SIZE], *val=NULL;
-    if(!grep_index_theme(base_dir, theme, key, buf, ICON_BUF_SIZE))
-        return NULL;
-    if((val=strchr(buf, '=')+1) == NULL)
-        return NULL;
+    if(depth == 1)
+        return pixel ? 0xff000000 : 0xffffffff;
 
-    size_t len, i, n=get_spec_char_num(val, ',')+2;
-    char **result=malloc(n*sizeof(char *));
-    for(len=0, i=0; i<n-1 && *val; val+=len+1)
+    unsigned long masks[]={v->red_mask, v->green_mask, v->blue_mask};
+    DATA32 argb=0xff000000;
+    for(size_t i=0; i<ARRAY_NUM(masks); i++)
     {
-        val[len=strcspn(val, ",")]='\0';
-        if(!filter || strstr(val, filter))
-            result[i++]=copy_strings(val, NULL);
+        unsigned long m=masks[i], c=pixel&m;
+        for(; m && !(m&1); m>>=1)
+            c>>=1;
+        argb |= (DATA32)(m ? c*0xff/m : 0) << (16-8*i);
     }
-    result[i]=NULL;
-    return filter ? realloc(result, ++i*sizeof(char *)) : result;
+    return argb;
 }
 
-static char *grep_index_theme(const char *base_dir, const char *theme, const char *key, char *buf, size_t size)
+/* 圖標主題目錄中出現了文件filename後，重新請求加載尚未得到圖像的同名圖標。
+ * 若filename不是圖標文件（如新增了子目錄或index.theme）或爲NULL，則重新請
+ * 求加載所有尚未得到圖像的圖標。 */
+void reload_icon_images(WM *wm, const char *filename)
 {
-    FILE *fp=open_index_theme(base_dir, theme);
-    if(fp == NULL)
-        return NULL;
+    const char *ext = filename ? strrchr(filename, '.') : NULL;
+    size_t n = ext && (!strcmp(ext, ".png") || !strcmp(ext, ".svg")
+        || !strcmp(ext, ".xpm")) ? (size_t)(ext-filename) : 0;
 
-    char *p=NULL;
-    while(!feof(fp) && (!fgets(buf, size, fp) || !(p=strstr(buf, key))))
-        ;
-    fclose(fp);
-    if(p == NULL)
-        return NULL;
-
-    if((p=strrchr(buf, '\n')))
-        *p='\0';
-    return buf;
-}
-
-static bool get_dir_info_from_index_theme(const char *base_dir, const char *theme, const char *sub_dir, Icon_dir_info *info)
-{
-    FILE *fp=open_index_theme(base_dir, theme);
-    if(fp == NULL)
-        return false;
-
-    bool result=false;
-    char buf[ICON_BUF_SIZE];
-    memset(info, 0, sizeof(Icon_dir_info));
-    // 先跳過目錄段標題，標題以'['開頭，以子目錄名過濾時應跳過它
-    while( !feof(fp)
-        && (!fgets(buf, ICON_BUF_SIZE, fp) || strstr(buf, sub_dir)!=buf+1))
-        ;
-    while( (result=!feof(fp)) && fgets(buf, ICON_BUF_SIZE, fp)
-        && get_icon_dir_info_from_buf(buf, ICON_BUF_SIZE, info))
-        ;
-    fclose(fp);
-    fix_icon_dir_info(info);
-    return result;
+    for(Icon_image *p=wm->icon_images; p; p=p->next)
+        if( p->source==ICON_FROM_FILE && !p->pixmap && p->name
+            && (!n || (!strncmp(p->name, filename, n) && !p->name[n])))
+            request_icon_load(p->name, p->size);
 }
 
-static bool get_icon_dir_info_from_buf(char *buf, size_t size, Icon_dir_info *info)
+/* 減少圖符圖像的引用計數，最後一個引用它的客戶窗口刪除時才釋放它 */
+void release_icon_image(WM *wm, Icon_image *image)
 {
-    for(size_t i=0, n=ARRAY_NUM(ICON_THEME_PER_DIR_KEYS); i<n; i++)
+    for(Icon_image **pp=&wm->icon_images; image && *pp; pp=&(*pp)->next)
     {
-        if(strstr(buf, ICON_THEME_PER_DIR_KEYS[i]) == buf)
+        if(*pp == image)
         {
-            char *val=strchr(buf, '=')+1;
-            *strrchr(val, '\n')='\0';
-            switch(i)
+            if(--image->refs == 0)
             {
-                case 0: info->size=atoi(val); return true;
-                case 1: info->scale=atoi(val); return true;
-                case 2: info->max_size=atoi(val); return true;
-                case 3: info->min_size=atoi(val); return true;
-                case 4: info->threshold=atoi(val); return true;
-                case 5: strcpy(info->type, val); return true;
-                default: return true; // 也就是info->context，目前用不上
+                *pp=image->next;
+                if(image->pixmap)
+                    XFreePixmap(wm->display, image->pixmap);
+                if(image->mask)
+                    XFreePixmap(wm->display, image->mask);
+                free(image->name);
+                free(image);
             }
+            return;
         }
     }
-    return false;
 }
 
-static void fix_icon_dir_info(Icon_dir_info *info)
+/* 讀出圖符像素圖及其形狀掩碼的ARGB像素數據，由調用者釋放 */
+static DATA32 *get_icon_data_from_hint(WM *wm, Client *c, unsigned int *w, unsigned int *h)
 {
-    if(info->scale == 0)
-        info->scale=1;
-    if(info->max_size==0)
-        info->max_size=info->size;
-    if(info->min_size == 0)
-        info->min_size=info->size;
-    if(info->threshold == 0)
-        info->threshold=2;
-    if(info->type[0] == '\0')
-        strcpy(info->type, "Threshold");
-}
-
-static FILE *open_index_theme(const char *base_dir, const char *theme)
-{
-    // 規範約定的主題文件全名爲：基本目錄/主題/index.theme
-    char *filename=copy_strings(base_dir, "/", theme, "/index.theme", NULL);
-    if(filename == NULL)
+    unsigned int d, mw, mh, md;
+    Pixmap pixmap=c->wm_hint->icon_pixmap, mask=c->wm_hint->icon_mask;
+    if( !(c->wm_hint->flags & IconPixmapHint) || !get_geometry(wm, pixmap, w, h, &d)
+        || !*w || !*h)
         return NULL;
-
-    FILE *fp=fopen(filename, "r");
-    free(filename);
-    return fp;
+    if( !(c->wm_hint->flags & IconMaskHint) || !get_geometry(wm, mask, &mw, &mh, &md)
+        || mw<*w || mh<*h)
+        mask=None;
+
+    XImage *image=XGetImage(wm->display, pixmap, 0, 0, *w, *h, AllPlanes, ZPixmap),
+           *mask_image = mask ? XGetImage(wm->display, mask, 0, 0, *w, *h, 1, ZPixmap) : NULL;
+    DATA32 *data = image ? malloc_s(*w**h*sizeof(DATA32)) : NULL;
+    for(unsigned int y=0; data && y<*h; y++)
+    {
+        for(unsigned int x=0; x<*w; x++)
+        {
+            DATA32 argb=get_argb_from_pixel(wm->visual, XGetPixel(image, x, y), d);
+            if(mask_image && !XGetPixel(mask_image, x, y))
+                argb &= 0x00ffffff;
+            data[y**w+x]=argb;
+        }
+    }
+    if(image)
+        XDestroyImage(image);
+    if(mask_image)
+        XDestroyImage(mask_image);
+    return data;
 }
 
-static size_t get_spec_char_num(const char *str, int ch)
+/* _NET_WM_ICON往往依次包含從16到512像素的多個圖標，總共幾百KB。故先逐個只
+ * 讀取各圖標的寬和高，選出尺寸最合適的圖標，然後只讀取該圖標的像素數據，並
+ * 返回其ARGB像素數據，由調用者釋放。 */
+static DATA32 *get_icon_data_from_prop(WM *wm, Client *c, unsigned int *w, unsigned int *h)
 {
-    size_t n=0;
-    if(str)
-        for(const char *p=str; *p; p++)
-            if(*p == ch)
-                n++;
-    return n;
+    long offset=0, best=-1;
+    unsigned long n=0, rest=0, iw=0, ih=0, bw=0, bh=0, *data=NULL;
+    Atom prop=wm->ewmh_atom[_NET_WM_ICON];
+
+    do
+    {
+        if(!(data=(unsigned long *)get_prop_range(wm, c->win, prop, offset, 2, &n, &rest)))
+            break;
+        iw = n==2 ? data[0] : 0, ih = n==2 ? data[1] : 0;
+        XFree(data);
+        // rest爲寬和高之後剩餘的字節數，須容得下該圖標的像素數據
+        if(!iw || !ih || iw>rest/4/ih)
+            break;
+        if(is_better_icon_size(MAX(iw, ih), MAX(bw, bh)))
+            best=offset, bw=iw, bh=ih;
+        offset+=2+iw*ih;
+    } while(rest/4 > iw*ih);
+
+    if( best == -1
+        || !(data=(unsigned long *)get_prop_range(wm, c->win, prop, best+2, bw*bh, &n, NULL)))
+        return NULL;
+    DATA32 *argb = n==bw*bh ? malloc_s(n*sizeof(DATA32)) : NULL;
+    /* imlib2和_NET_WM_ICON同樣使用大端字節序，因此不必轉換字節序 */
+    if(argb)
+        narrow_argb(argb, data, n), *w=bw, *h=bh;
+    XFree(data);
+    return argb;
 }
 
-static char **get_parent_themes(const char *base_dir, const char *theme)
+/* 優先選不小於圖符尺寸的最小圖標，只縮小不放大；都比圖符小時選最大的 */
+static bool is_better_icon_size(unsigned long size, unsigned long best)
 {
-    return get_list_val_from_index_theme(base_dir, theme, "Inherits=", NULL);
+    if(size >= ICON_SIZE)
+        return best<ICON_SIZE || size<best;
+    return best<ICON_SIZE && size>best;
 }
 
-static bool is_accessible(const char *filename)
+/* 當long大小爲8字節時，以long型數組存儲的特性數據，每個元素的前4字節都是填
+ * 充0，須逐個截斷爲32位。每次處理4個像素，指針互不重疊，循環體無分支，即使
+ * 在-O2下編譯器也能將其向量化爲SIMD指令。 */
+static void narrow_argb(DATA32 *restrict dst, const unsigned long *restrict src, size_t n)
 {
-    if(filename == NULL)
-        return false;
-
-    struct stat buf;
-    return !stat(filename, &buf);
+    size_t i=0;
+    if(sizeof(long) == sizeof(DATA32))
+        memcpy(dst, src, n*sizeof(DATA32));
+    else
+    {
+        for(; i+4<=n; i+=4)
+        {
+            dst[i]=src[i], dst[i+1]=src[i+1];
+            dst[i+2]=src[i+2], dst[i+3]=src[i+3];
+        }
+        for(; i<n; i++)
+            dst[i]=src[i];
+    }
 }
 
 #endif
@@ -426,6 +374,7 @@ static void create_icon(WM *wm, Client *c)
         wm->widget_color[NORMAL_BORDER_COLOR].pixel,
         wm->widget_color[ICON_COLOR].pixel);
     XSelectInput(wm->display, c->icon->win, ICON_WIN_EVENT_MASK);
+    set_win_index(wm, p->win, c, CLIENT_ICON);
 #if USE_IMAGE_ICON
     set_icon_image(wm, c);
 #endif
@@ -474,7 +423,7 @@ void draw_icon(WM *wm, Client *c)
     String_format f={{0, 0, i->w, i->h}, CENTER_LEFT, false, 0,
         wm->text_color[CLASS_TEXT_COLOR], CLASS_FONT};
 #if USE_IMAGE_ICON
-    if(c->image)
+    if(c->icon_image && c->icon_image->pixmap)
         draw_string(wm, i->win, "", &f), draw_icon_image(wm, c);
     else
         draw_string(wm, i->win, c->class_name, &f);
@@ -504,6 +453,10 @@ void deiconify(WM *wm, Client *c)
 
 void del_icon(WM *wm, Client *c)
 {
+    if(wm->hover.win == c->icon->win)
+        cancel_hover(wm);
+    del_win_index(wm, c->icon->win);
+    del_xft_draw(wm, c->icon->win);
     XDestroyWindow(wm->display, c->icon->win);
     c->area_type=c->icon->area_type;
     free(c->icon->title_text);
@@ -16,6 +16,9 @@ void iconify(WM *wm, Client *c);
 void update_icon_area(WM *wm);
 unsigned int get_icon_draw_width(WM *wm, Client *c);
 void draw_icon(WM *wm, Client *c);
+void release_icon_image(WM *wm, Icon_image *image);
+void handle_icon_loads(WM *wm);
+void reload_icon_images(WM *wm, const char *filename);
 void deiconify(WM *wm, Client *c);
 void del_icon(WM *wm, Client *c);
 
@@ -0,0 +1,427 @@
+/* *************************************************************************
+ *     icon_cache.c：實現圖標搜索結果的磁盤緩存。
+ *     版權 (C) 2020-2022 gsm <406643764@qq.com>
+ *     本程序為自由軟件：你可以依據自由軟件基金會所發布的第三版或更高版本的
+ * GNU通用公共許可證重新發布、修改本程序。
+ *     雖然基于使用目的而發布本程序，但不負任何擔保責任，亦不包含適銷性或特
+ * 定目標之適用性的暗示性擔保。詳見GNU通用公共許可證。
+ *     你應該已經收到一份附隨此程序的GNU通用公共許可證副本。否則，請參閱
+ * <http://www.gnu.org/licenses/>。
+ * ************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L // 爲了使用st_mtim
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gwm.h"
+#include "icon_cache.h"
+#include "misc.h"
+
+/* 緩存文件是以追加方式寫入的文本文件，首行是文件標識及以製表符分隔的基本
+ * 目錄列表，基本目錄不同時搜索結果也不同，故首行不符即丟棄緩存。其後每行一
+ * 條記錄，各字段以製表符分隔：
+ *     S    修改時間    路徑
+ *     I    主題    圖標名    尺寸    縮放比例    context目錄    圖標文件全名
+ *     X    圖標名
+ * S行是圖標主題目錄、index.theme及基本目錄的修改時間戳，不存在的路徑記爲0，
+ * 同一路徑有多行時以最後一行爲準。啓動時只要有一個時間戳與實際不符，就丟棄
+ * 整個緩存，從而能發現新裝的圖標。I行是一次搜索的結果，圖標文件全名爲空表示
+ * 找不到圖標。X行使此前該圖標名的I行失效，圖標名爲空時使此前所有I行失效，
+ * 運行時監視到圖標文件變化即追加X行及新的S行，故緩存不必因此整個丟棄。讀取
+ * 時用mmap映射整個文件，解析到內存散列表中即解除映射。若文件中有X行或被取代
+ * 的S行、I行，則按內存中的記錄重寫到臨時文件，再改名覆蓋緩存文件，以免文件
+ * 無限增長。 */
+
+#define ICON_CACHE_MAGIC "gwm-icon-cache 1"
+#define ICON_CACHE_MTIME_SIZE 32 // 修改時間字符串的最大長度
+#define ICON_CACHE_BUCKET_N_MIN 64 // 緩存記錄散列表的初始桶數
+
+struct icon_cache_item_tag // 圖標搜索結果或時間戳
+{
+    char *key; // 對於I行，是從主題到context目錄的各字段；對於S行，是路徑
+    char *val; // 對於I行，是圖標文件全名；對於S行，是修改時間
+    struct icon_cache_item_tag *next;
+};
+typedef struct icon_cache_item_tag Icon_cache_item;
+
+struct icon_cache_table_tag // 以鍵的散列值分桶的緩存記錄表
+{
+    size_t bucket_n, item_n; // 桶數、記錄數
+    Icon_cache_item **buckets;
+};
+typedef struct icon_cache_table_tag Icon_cache_table;
+
+static int cache_fd=-1; // 緩存文件的描述符，未打開或打開失敗時爲-1
+static Icon_cache_table icons, stamps; // 圖標搜索結果、時間戳
+static bool is_stale=false; // 加載的緩存文件中是否有已失效的行
+
+static char *get_icon_cache_filename(void);
+static char *get_icon_cache_header(char *const *base_dirs);
+static bool load_icon_cache(const char *data, size_t size, const char *header);
+static bool load_icon_cache_line(char *line);
+static void reset_icon_cache(const char *header);
+static void compact_icon_cache(const char *filename, const char *header);
+static void write_icon_cache_items(const char *type, const Icon_cache_table *table);
+static char *get_icon_cache_key(const char *theme, const char *name, int size, int scale, const char *context_dir);
+static Icon_cache_item *find_icon_cache_item(const Icon_cache_table *table, const char *key);
+static void add_icon_cache_item(Icon_cache_table *table, const char *key, const char *val);
+static void rehash_icon_cache_items(Icon_cache_table *table);
+static void write_icon_cache_line(const char *type, const char *key, const char *val);
+static void get_mtime_string(const char *path, char *buf);
+static void del_icon_cache_items(const char *name);
+static bool is_icon_key_name(const char *key, const char *name);
+static void free_icon_cache_items(Icon_cache_table *table);
+
+/* 查找緩存的圖標搜索結果。若有緩存，則返回真，並由filename返回圖標文件全
+ * 名或空指針（表示找不到圖標），該文件名由調用者釋放。 */
+bool find_cached_icon(const char *theme, const char *name, int size, int scale, const char *context_dir, char **filename)
+{
+    char *key=get_icon_cache_key(theme, name, size, scale, context_dir);
+    Icon_cache_item *p = key&&cache_fd!=-1 ? find_icon_cache_item(&icons, key) : NULL;
+    free(key);
+    if(p)
+        *filename = *p->val ? copy_string(p->val) : NULL;
+    return p;
+}
+
+void add_cached_icon(const char *theme, const char *name, int size, int scale, const char *context_dir, const char *filename)
+{
+    char *key=get_icon_cache_key(theme, name, size, scale, context_dir);
+    if(key && cache_fd!=-1 && !(filename && strpbrk(filename, "\t\n"))
+        && !find_icon_cache_item(&icons, key))
+    {
+        add_icon_cache_item(&icons, key, filename ? filename : "");
+        write_icon_cache_line("I", key, filename ? filename : "");
+    }
+    free(key);
+}
+
+/* 記錄搜索圖標時所依據的路徑的修改時間，每個路徑只記錄一次 */
+void add_icon_cache_stamp(const char *path)
+{
+    char mtime[ICON_CACHE_MTIME_SIZE];
+    if(cache_fd==-1 || strpbrk(path, "\t\n") || find_icon_cache_item(&stamps, path))
+        return;
+    get_mtime_string(path, mtime);
+    add_icon_cache_item(&stamps, path, mtime);
+    write_icon_cache_line("S", path, mtime);
+}
+
+/* 若path的修改時間已有記錄，則更新它 */
+void refresh_icon_cache_stamp(const char *path)
+{
+    char mtime[ICON_CACHE_MTIME_SIZE];
+    Icon_cache_item *p=find_icon_cache_item(&stamps, path);
+    if(cache_fd==-1 || !p)
+        return;
+    get_mtime_string(path, mtime);
+    if(strcmp(p->val, mtime))
+    {
+        free(p->val), p->val=copy_string(mtime);
+        write_icon_cache_line("S", path, mtime);
+    }
+}
+
+/* 使名爲name的圖標的搜索結果失效，name爲NULL時使所有搜索結果失效 */
+void del_cached_icons(const char *name)
+{
+    if(cache_fd==-1 || (name && strpbrk(name, "\t\n")))
+        return;
+    del_icon_cache_items(name);
+    write_icon_cache_line("X", name ? name : "", NULL);
+}
+
+void close_icon_cache(void)
+{
+    if(cache_fd != -1)
+        close(cache_fd);
+    cache_fd=-1;
+    free_icon_cache_items(&icons);
+    free_icon_cache_items(&stamps);
+}
+
+/* 打開並加載緩存文件，base_dirs是以NULL結尾的基本目錄列表。打開失敗時不使
+ * 用緩存，只是每次都要搜索主題。 */
+void open_icon_cache(char *const *base_dirs)
+{
+    char *filename=NULL;
+    struct stat st;
+    if(cache_fd!=-1 || !(filename=get_icon_cache_filename()))
+        return;
+    cache_fd=open(filename, O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+    if(cache_fd == -1 || fstat(cache_fd, &st) == -1)
+    {
+        perror("不能打開圖標緩存文件");
+        close_icon_cache();
+        free(filename);
+        return;
+    }
+
+    bool is_valid=false;
+    char *header=get_icon_cache_header(base_dirs);
+    if(st.st_size > 0)
+    {
+        void *data=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, cache_fd, 0);
+        if(data != MAP_FAILED)
+        {
+            is_valid=load_icon_cache(data, st.st_size, header);
+            munmap(data, st.st_size);
+        }
+    }
+    if(!is_valid)
+        reset_icon_cache(header);
+    else if(is_stale)
+        compact_icon_cache(filename, header);
+    is_stale=false;
+    free(header);
+    free(filename);
+}
+
+/* 緩存文件全名爲：$XDG_CACHE_HOME/gwm/icon-cache，XDG基本目錄規範規定
+ * XDG_CACHE_HOME的默認值爲$HOME/.cache */
+static char *get_icon_cache_filename(void)
+{
+    const char *xdg=getenv("XDG_CACHE_HOME"), *home=getenv("HOME");
+    char *dir=NULL, *filename=NULL;
+    if(xdg && *xdg)
+        dir=copy_string(xdg);
+    else if(home && *home)
+        dir=copy_strings(home, "/.cache", NULL);
+    else
+        return NULL;
+
+    mkdir(dir, 0700);
+    filename=copy_strings(dir, "/gwm", NULL);
+    mkdir(filename, 0700);
+    free(filename);
+    filename=copy_strings(dir, "/gwm/icon-cache", NULL);
+    free(dir);
+    return filename;
+}
+
+static char *get_icon_cache_header(char *const *base_dirs)
+{
+    char *header=copy_string(ICON_CACHE_MAGIC), *p=NULL;
+    for(char *const *b=base_dirs; *b; b++)
+        p=header, header=copy_strings(p, "\t", *b, NULL), free(p);
+    p=header, header=copy_strings(p, "\n", NULL), free(p);
+    return header;
+}
+
+static bool load_icon_cache(const char *data, size_t size, const char *header)
+{
+    size_t n=strlen(header);
+    if(size<n || memcmp(data, header, n))
+        return false;
+
+    bool is_valid=true;
+    for(const char *p=data+n, *end=data+size, *eol=NULL; is_valid && p<end; p=eol+1)
+    {
+        if((eol=memchr(p, '\n', end-p)) == NULL)
+            break; // 最後一行不完整，可能是寫入時被中斷了，忽略它
+        char *line=malloc_s(eol-p+1);
+        memcpy(line, p, eol-p), line[eol-p]='\0';
+        is_valid=load_icon_cache_line(line);
+        free(line);
+    }
+    for(size_t i=0; is_valid && i<stamps.bucket_n; i++)
+    {
+        for(Icon_cache_item *p=stamps.buckets[i]; is_valid && p; p=p->next)
+        {
+            char mtime[ICON_CACHE_MTIME_SIZE];
+            get_mtime_string(p->key, mtime);
+            is_valid=!strcmp(p->val, mtime);
+        }
+    }
+    return is_valid;
+}
+
+/* 解析一行記錄，格式錯誤時返回假。時間戳在全部解析後才核對。有X行或重複
+ * 的鍵時，說明文件中有失效的行。 */
+static bool load_icon_cache_line(char *line)
+{
+    char *val=strrchr(line, '\t');
+    if(strlen(line)<2 || line[1]!='\t')
+        return false;
+    if(line[0] == 'X')
+        return del_icon_cache_items(line[2] ? line+2 : NULL), is_stale=true;
+    if(val<line+2 || (line[0]!='S' && line[0]!='I'))
+        return false;
+
+    *val++='\0';
+    /* S行的路徑在最後一個字段，修改時間在中間 */
+    bool is_stamp = line[0]=='S';
+    char *key = is_stamp ? val : line+2, *v = is_stamp ? line+2 : val;
+    Icon_cache_table *table = is_stamp ? &stamps : &icons;
+    Icon_cache_item *p=find_icon_cache_item(table, key);
+    if(p)
+        free(p->val), p->val=copy_string(v), is_stale=true;
+    else
+        add_icon_cache_item(table, key, v);
+    return true;
+}
+
+static void reset_icon_cache(const char *header)
+{
+    free_icon_cache_items(&icons);
+    free_icon_cache_items(&stamps);
+    if(ftruncate(cache_fd, 0) == -1)
+        perror("不能清空圖標緩存文件");
+    write_icon_cache_line(NULL, header, NULL);
+}
+
+/* 把內存中的記錄寫入臨時文件，再改名覆蓋緩存文件。其他gwm實例仍可能向舊文
+ * 件追加，那些記錄會丟失，但只是以後要重新搜索而已。失敗時繼續使用舊文件。 */
+static void compact_icon_cache(const char *filename, const char *header)
+{
+    char buf[32];
+    sprintf(buf, ".%ld", (long)getpid());
+    char *tmp=copy_strings(filename, buf, NULL);
+    int fd=open(tmp, O_RDWR|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC, 0644), old=cache_fd;
+    if(fd == -1)
+    {
+        perror("不能創建臨時圖標緩存文件");
+        free(tmp);
+        return;
+    }
+
+    cache_fd=fd;
+    write_icon_cache_line(NULL, header, NULL);
+    write_icon_cache_items("S", &stamps);
+    write_icon_cache_items("I", &icons);
+    if(rename(tmp, filename) == -1)
+    {
+        perror("不能替換圖標緩存文件");
+        unlink(tmp), close(fd), cache_fd=old;
+    }
+    else
+        close(old);
+    free(tmp);
+}
+
+static void write_icon_cache_items(const char *type, const Icon_cache_table *table)
+{
+    for(size_t i=0; i<table->bucket_n; i++)
+        for(Icon_cache_item *p=table->buckets[i]; p; p=p->next)
+            write_icon_cache_line(type, p->key, p->val);
+}
+
+/* 製表符和換行符是緩存文件的分隔符，含這些字符的名稱不緩存 */
+static char *get_icon_cache_key(const char *theme, const char *name, int size, int scale, const char *context_dir)
+{
+    char buf[32];
+    if(!context_dir)
+        context_dir="";
+    if(strpbrk(theme, "\t\n") || strpbrk(name, "\t\n") || strpbrk(context_dir, "\t\n"))
+        return NULL;
+    sprintf(buf, "\t%d\t%d\t", size, scale);
+    return copy_strings(theme, "\t", name, buf, context_dir, NULL);
+}
+
+static Icon_cache_item *find_icon_cache_item(const Icon_cache_table *table, const char *key)
+{
+    if(!table->item_n)
+        return NULL;
+    for(Icon_cache_item *p=table->buckets[get_string_hash(key)%table->bucket_n]; p; p=p->next)
+        if(strcmp(p->key, key) == 0)
+            return p;
+    return NULL;
+}
+
+/* 調用者應確保表中沒有鍵爲key的記錄 */
+static void add_icon_cache_item(Icon_cache_table *table, const char *key, const char *val)
+{
+    if(table->item_n >= table->bucket_n)
+        rehash_icon_cache_items(table);
+
+    Icon_cache_item **pp=table->buckets+get_string_hash(key)%table->bucket_n;
+    Icon_cache_item *p=malloc_s(sizeof(Icon_cache_item));
+    *p=(Icon_cache_item){copy_string(key), copy_string(val), *pp};
+    *pp=p, table->item_n++;
+}
+
+/* 使桶數翻倍，讓每個桶的平均記錄數不超過1 */
+static void rehash_icon_cache_items(Icon_cache_table *table)
+{
+    size_t n=MAX(table->bucket_n*2, ICON_CACHE_BUCKET_N_MIN);
+    Icon_cache_item **buckets=malloc_s(n*sizeof(Icon_cache_item *));
+    memset(buckets, 0, n*sizeof(Icon_cache_item *));
+    for(size_t i=0; i<table->bucket_n; i++)
+    {
+        for(Icon_cache_item *p=table->buckets[i], *next=NULL; p; p=next)
+        {
+            Icon_cache_item **pp=buckets+get_string_hash(p->key)%n;
+            next=p->next, p->next=*pp, *pp=p;
+        }
+    }
+    free(table->buckets);
+    table->buckets=buckets, table->bucket_n=n;
+}
+
+/* 以一次write追加一整行，即使多個gwm實例共用緩存文件，各行也不會交錯。
+ * S行的字段順序爲：類型、修改時間、路徑；I行爲：類型、鍵、圖標文件全名；
+ * X行爲：類型、圖標名。type爲空指針時，key即爲整行內容。 */
+static void write_icon_cache_line(const char *type, const char *key, const char *val)
+{
+    if(cache_fd == -1)
+        return;
+
+    char *line=NULL;
+    if(!type)
+        line=copy_string(key);
+    else if(!strcmp(type, "S"))
+        line=copy_strings(type, "\t", val, "\t", key, "\n", NULL);
+    else if(!strcmp(type, "X"))
+        line=copy_strings(type, "\t", key, "\n", NULL);
+    else
+        line=copy_strings(type, "\t", key, "\t", val, "\n", NULL);
+    size_t len=strlen(line);
+    if(write(cache_fd, line, len) != (ssize_t)len)
+        perror("不能寫入圖標緩存文件");
+    free(line);
+}
+
+static void get_mtime_string(const char *path, char *buf)
+{
+    struct stat st;
+    if(stat(path, &st) == -1)
+        strcpy(buf, "0");
+    else
+        sprintf(buf, "%lld.%09ld", (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+}
+
+/* 鍵以主題開頭，同名圖標分散在各桶中，故要遍歷整個表。只在圖標文件變化時
+ * 調用，不影響查找的效率。 */
+static void del_icon_cache_items(const char *name)
+{
+    for(size_t i=0; i<icons.bucket_n; i++)
+    {
+        for(Icon_cache_item **pp=icons.buckets+i, *p=NULL; (p=*pp); )
+        {
+            if(!name || is_icon_key_name(p->key, name))
+                *pp=p->next, free(p->key), free(p->val), free(p), icons.item_n--;
+            else
+                pp=&p->next;
+        }
+    }
+}
+
+/* 鍵的第二個字段是圖標名 */
+static bool is_icon_key_name(const char *key, const char *name)
+{
+    const char *p=strchr(key, '\t');
+    size_t len=strlen(name);
+    return p && !strncmp(p+1, name, len) && p[len+1]=='\t';
+}
+
+static void free_icon_cache_items(Icon_cache_table *table)
+{
+    for(size_t i=0; i<table->bucket_n; i++)
+        for(Icon_cache_item *p=table->buckets[i], *next=NULL; p; p=next)
+            next=p->next, free(p->key), free(p->val), free(p);
+    free(table->buckets);
+    *table=(Icon_cache_table){0};
+}
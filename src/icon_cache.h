@@ -0,0 +1,23 @@
+/* *************************************************************************
+ *     icon_cache.h：與icon_cache.c相應的頭文件。
+ *     版權 (C) 2020-2022 gsm <406643764@qq.com>
+ *     本程序為自由軟件：你可以依據自由軟件基金會所發布的第三版或更高版本的
+ * GNU通用公共許可證重新發布、修改本程序。
+ *     雖然基于使用目的而發布本程序，但不負任何擔保責任，亦不包含適銷性或特
+ * 定目標之適用性的暗示性擔保。詳見GNU通用公共許可證。
+ *     你應該已經收到一份附隨此程序的GNU通用公共許可證副本。否則，請參閱
+ * <http://www.gnu.org/licenses/>。
+ * ************************************************************************/
+
+#ifndef ICON_CACHE_H
+#define ICON_CACHE_H
+
+void open_icon_cache(char *const *base_dirs);
+bool find_cached_icon(const char *theme, const char *name, int size, int scale, const char *context_dir, char **filename);
+void add_cached_icon(const char *theme, const char *name, int size, int scale, const char *context_dir, const char *filename);
+void add_icon_cache_stamp(const char *path);
+void refresh_icon_cache_stamp(const char *path);
+void del_cached_icons(const char *name);
+void close_icon_cache(void);
+
+#endif
@@ -0,0 +1,242 @@
+/* *************************************************************************
+ *     icon_loader.c：實現在後臺線程中搜索並解碼圖標文件的功能。
+ *     版權 (C) 2020-2022 gsm <406643764@qq.com>
+ *     本程序為自由軟件：你可以依據自由軟件基金會所發布的第三版或更高版本的
+ * GNU通用公共許可證重新發布、修改本程序。
+ *     雖然基于使用目的而發布本程序，但不負任何擔保責任，亦不包含適銷性或特
+ * 定目標之適用性的暗示性擔保。詳見GNU通用公共許可證。
+ *     你應該已經收到一份附隨此程序的GNU通用公共許可證副本。否則，請參閱
+ * <http://www.gnu.org/licenses/>。
+ * ************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L // 爲了使用pthread_sigmask
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "gwm.h"
+#include "icon_loader.h"
+#include "icon_theme.h"
+#include "misc.h"
+
+/* 搜索圖標主題、讀取並解碼PNG、SVG等圖標文件都很慢，若在主循環中進行，縮微
+ * 大量窗口時會明顯卡頓。故由一個加載線程依次完成這些任務，把圖像縮放爲所需
+ * 尺寸，以ARGB像素數據返回，並通過eventfd通知主循環，由主循環生成像素圖。
+ * 來自WM_HINTS和_NET_WM_ICON的圖像由主循環讀出像素數據，也交給加載線程縮放。
+ * 加載線程不訪問X服務器，只調用find_icon和imlib2。imlib2不是線程安全的，
+ * 其上下文是全局的，故兩個線程使用imlib2時都須持有imlib_mutex。主循環處理
+ * 圖符時不使用imlib2，只有設置壁紙和截圖時纔會與加載線程爭用該鎖，且持鎖時
+ * 不應另外發出X請求。 */
+
+static pthread_mutex_t imlib_mutex=PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t load_mutex=PTHREAD_MUTEX_INITIALIZER; // 保護任務鏈表和is_quitting
+static pthread_cond_t load_cond=PTHREAD_COND_INITIALIZER; // 有新任務或應退出
+static Icon_load *pending_loads=NULL, *finished_loads=NULL; // 待加載、已加載的任務
+static bool is_quitting=false; // 加載線程是否應退出
+static pthread_t loader;
+static int notify_fd=-1; // 通知主循環有任務完成的eventfd
+
+static void add_pending_load(Icon_load *load);
+static void *run_icon_loader(void *unused);
+static DATA32 *load_icon_data(const char *name, unsigned int size);
+static DATA32 *scale_icon_data(const DATA32 *src, unsigned int w, unsigned int h, unsigned int size);
+static DATA32 *scale_icon_image(Imlib_Image image, unsigned int size);
+
+void init_icon_loader(WM *wm)
+{
+    sigset_t all, old;
+    if((notify_fd=eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) == -1)
+        exit_with_perror("不能創建eventfd");
+    wm->icon_load_fd=notify_fd;
+
+    /* 信號由主線程的signalfd接收，故加載線程應屏蔽所有信號 */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err=pthread_create(&loader, NULL, run_icon_loader, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(err)
+        exit_with_msg("錯誤：不能創建圖標加載線程");
+}
+
+void clear_icon_loader(WM *wm)
+{
+    if(notify_fd == -1)
+        return;
+
+    pthread_mutex_lock(&load_mutex);
+    is_quitting=true;
+    pthread_cond_signal(&load_cond);
+    pthread_mutex_unlock(&load_mutex);
+    pthread_join(loader, NULL);
+
+    for(Icon_load *l=pending_loads, *next=NULL; l; l=next)
+        next=l->next, free_icon_load(l);
+    for(Icon_load *l=finished_loads, *next=NULL; l; l=next)
+        next=l->next, free_icon_load(l);
+    pending_loads=finished_loads=NULL, is_quitting=false;
+    close(notify_fd);
+    wm->icon_load_fd=notify_fd=-1;
+}
+
+/* 請求加載名爲name的應用程序圖標，並縮放爲size*size */
+void request_icon_load(const char *name, unsigned int size)
+{
+    Icon_load *l=malloc_s(sizeof(Icon_load));
+    *l=(Icon_load){false, ICON_FROM_FILE, 0, copy_string(name), NULL, false,
+        0, 0, NULL, size, NULL, NULL};
+    add_pending_load(l);
+}
+
+/* 請求把主循環已讀取的w*h的ARGB像素數據src縮放爲size*size。src由加載線程
+ * 釋放。source、id、name是該圖像的鍵值，以便加載完成時找到該圖像。 */
+void request_icon_scale(Icon_source source, unsigned long id, const char *name, unsigned int w, unsigned int h, DATA32 *src, unsigned int size)
+{
+    Icon_load *l=malloc_s(sizeof(Icon_load));
+    *l=(Icon_load){false, source, id, name ? copy_string(name) : NULL, NULL,
+        false, w, h, src, size, NULL, NULL};
+    add_pending_load(l);
+}
+
+/* 請求按文件變化更新圖標主題，參數的含義見update_icon_themes。主題數據只由
+ * 加載線程訪問，故更新也由它按請求順序完成，隨後的加載任務即可見到更新。 */
+void request_icon_theme_update(const char *dir, const char *file, bool is_added)
+{
+    Icon_load *l=malloc_s(sizeof(Icon_load));
+    *l=(Icon_load){true, ICON_FROM_FILE, 0, file ? copy_string(file) : NULL,
+        dir ? copy_string(dir) : NULL, is_added, 0, 0, NULL, 0, NULL, NULL};
+    add_pending_load(l);
+}
+
+static void add_pending_load(Icon_load *load)
+{
+    Icon_load **pp=&pending_loads;
+    pthread_mutex_lock(&load_mutex);
+    while(*pp) // 先請求的先處理
+        pp=&(*pp)->next;
+    *pp=load;
+    pthread_cond_signal(&load_cond);
+    pthread_mutex_unlock(&load_mutex);
+}
+
+/* 取出一個已完成的加載任務，沒有則返回NULL。取出的任務由調用者用
+ * free_icon_load釋放。 */
+Icon_load *get_icon_load(void)
+{
+    uint64_t n;
+    Icon_load *l=NULL;
+    if(read(notify_fd, &n, sizeof(n)) == -1 && errno != EAGAIN)
+        perror("不能讀取eventfd");
+    pthread_mutex_lock(&load_mutex);
+    if((l=finished_loads))
+        finished_loads=l->next;
+    pthread_mutex_unlock(&load_mutex);
+    return l;
+}
+
+void free_icon_load(Icon_load *load)
+{
+    free(load->name);
+    free(load->dir);
+    free(load->src);
+    free(load->data);
+    free(load);
+}
+
+void lock_imlib(void)
+{
+    pthread_mutex_lock(&imlib_mutex);
+}
+
+void unlock_imlib(void)
+{
+    pthread_mutex_unlock(&imlib_mutex);
+}
+
+static void *run_icon_loader(void *unused)
+{
+    uint64_t one=1;
+    pthread_mutex_lock(&load_mutex);
+    while(true)
+    {
+        while(!is_quitting && !pending_loads)
+            pthread_cond_wait(&load_cond, &load_mutex);
+        if(is_quitting)
+            break;
+
+        Icon_load *l=pending_loads;
+        pending_loads=l->next;
+        pthread_mutex_unlock(&load_mutex);
+        if(l->is_update)
+        {
+            update_icon_themes(l->dir, l->name, l->is_added);
+            free_icon_load(l);
+            pthread_mutex_lock(&load_mutex);
+            continue;
+        }
+        if(l->src)
+        {
+            l->data=scale_icon_data(l->src, l->w, l->h, l->size);
+            free(l->src), l->src=NULL;
+        }
+        else
+            l->data=load_icon_data(l->name, l->size);
+        pthread_mutex_lock(&load_mutex);
+        l->next=finished_loads, finished_loads=l;
+        if(write(notify_fd, &one, sizeof(one)) == -1)
+            perror("不能寫入eventfd");
+    }
+    pthread_mutex_unlock(&load_mutex);
+    return NULL;
+}
+
+/* 返回縮放後的ARGB像素數據，找不到或不能解碼圖標文件時返回NULL */
+static DATA32 *load_icon_data(const char *name, unsigned int size)
+{
+    char *filename=find_icon(name, size, 1, "apps");
+    if(!filename)
+        return NULL;
+
+    lock_imlib();
+    DATA32 *data=scale_icon_image(imlib_load_image(filename), size);
+    unlock_imlib();
+    free(filename);
+    return data;
+}
+
+static DATA32 *scale_icon_data(const DATA32 *src, unsigned int w, unsigned int h, unsigned int size)
+{
+    lock_imlib();
+    /* 只讀取而不修改src，imlib2釋放圖像時也不會釋放它 */
+    Imlib_Image image=imlib_create_image_using_data(w, h, (DATA32 *)src);
+    if(image)
+    {
+        imlib_context_set_image(image);
+        imlib_image_set_has_alpha(1);
+    }
+    DATA32 *data=scale_icon_image(image, size);
+    unlock_imlib();
+    return data;
+}
+
+/* 調用者須持有imlib的鎖。image可爲NULL，並隨即釋放。 */
+static DATA32 *scale_icon_image(Imlib_Image image, unsigned int size)
+{
+    DATA32 *data=NULL;
+    Imlib_Image scaled=NULL;
+    if(image)
+    {
+        imlib_context_set_image(image);
+        scaled=imlib_create_cropped_scaled_image(0, 0, imlib_image_get_width(),
+            imlib_image_get_height(), size, size);
+        imlib_free_image();
+    }
+    if(scaled)
+    {
+        imlib_context_set_image(scaled);
+        data=malloc_s(size*size*sizeof(DATA32));
+        memcpy(data, imlib_image_get_data_for_reading_only(), size*size*sizeof(DATA32));
+        imlib_free_image();
+    }
+    return data;
+}
@@ -0,0 +1,25 @@
+/* *************************************************************************
+ *     icon_loader.h：與icon_loader.c相應的頭文件。
+ *     版權 (C) 2020-2022 gsm <406643764@qq.com>
+ *     本程序為自由軟件：你可以依據自由軟件基金會所發布的第三版或更高版本的
+ * GNU通用公共許可證重新發布、修改本程序。
+ *     雖然基于使用目的而發布本程序，但不負任何擔保責任，亦不包含適銷性或特
+ * 定目標之適用性的暗示性擔保。詳見GNU通用公共許可證。
+ *     你應該已經收到一份附隨此程序的GNU通用公共許可證副本。否則，請參閱
+ * <http://www.gnu.org/licenses/>。
+ * ************************************************************************/
+
+#ifndef ICON_LOADER_H
+#define ICON_LOADER_H
+
+void init_icon_loader(WM *wm);
+void clear_icon_loader(WM *wm);
+void request_icon_load(const char *name, unsigned int size);
+void request_icon_scale(Icon_source source, unsigned long id, const char *name, unsigned int w, unsigned int h, DATA32 *src, unsigned int size);
+void request_icon_theme_update(const char *dir, const char *file, bool is_added);
+Icon_load *get_icon_load(void);
+void free_icon_load(Icon_load *load);
+void lock_imlib(void);
+void unlock_imlib(void);
+
+#endif
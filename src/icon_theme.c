@@ -0,0 +1,880 @@
+/* *************************************************************************
+ *     icon_theme.c：實現按圖標主題規範搜索圖標文件的功能。
+ *     版權 (C) 2020-2022 gsm <406643764@qq.com>
+ *     本程序為自由軟件：你可以依據自由軟件基金會所發布的第三版或更高版本的
+ * GNU通用公共許可證重新發布、修改本程序。
+ *     雖然基于使用目的而發布本程序，但不負任何擔保責任，亦不包含適銷性或特
+ * 定目標之適用性的暗示性擔保。詳見GNU通用公共許可證。
+ *     你應該已經收到一份附隨此程序的GNU通用公共許可證副本。否則，請參閱
+ * <http://www.gnu.org/licenses/>。
+ * ************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L // 爲了使用getline
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gwm.h"
+#include "icon_cache.h"
+#include "icon_theme.h"
+#include "misc.h"
+#include "watch.h"
+
+/* 以下尋找圖標文件的算法參考《圖標主題規範》(以下簡稱規範，詳見：
+ * specifications.freedesktop.org/icon-theme-spec/icon-theme-spec-latest.html)
+ * ，並修正其謬誤，及提高效率。各主題的index.theme只在首次用到時解析一次，
+ * 此後的搜索只在內存中匹配，基本目錄列表也只計算一次。各圖標目錄亦只在首
+ * 次搜索到它時用readdir列出一次，按圖標名存入散列集，此後判斷圖標是否存在
+ * 只需查找散列集，不必再爲每個候選文件名調用stat。若主題目錄中有不舊於該
+ * 目錄的icon-theme.cache（由gtk-update-icon-cache生成），則映射到內存直接
+ * 查找，連目錄也不必列出。用到的目錄都以inotify監視，文件增刪時由
+ * update_icon_themes增量更新以上數據。 */
+
+#define ICON_THEME_DEPTH_MAX 8 // 遞歸搜索父主題的最大深度，以防主題互相繼承
+// 目前圖標主題規範只支持這三種格式的圖標
+#define ICON_EXT (const char *[]){".png", ".svg", ".xpm"}
+#define ICON_FILE_BUCKET_N_MIN 16 // 圖標文件散列集的初始桶數
+#define ICON_CACHE_NONE UINT32_MAX // icon-theme.cache中的空偏移量，亦表示越界
+
+enum icon_dir_type_tag // 圖標目錄的類型，即index.theme中的Type鍵
+{
+    FIXED_ICON_DIR, SCALED_ICON_DIR, THRESHOLD_ICON_DIR,
+};
+typedef enum icon_dir_type_tag Icon_dir_type;
+
+struct icon_file_tag // 目錄中的圖標文件
+{
+    char *name; // 去掉擴展名的文件名，即圖標名
+    unsigned int exts; // 已有的擴展名，第i位對應ICON_EXT[i]
+    struct icon_file_tag *next;
+};
+typedef struct icon_file_tag Icon_file;
+
+struct icon_file_set_tag // 某個目錄中的圖標文件的散列集
+{
+    bool is_listed; // 是否已列出目錄
+    size_t bucket_n, file_n; // 桶數、文件數
+    Icon_file **buckets;
+};
+typedef struct icon_file_set_tag Icon_file_set;
+
+// 存儲圖標主題規範所說的Per-Directory Keys的結構
+struct icon_dir_tag
+{
+    char *name; // 相對於主題目錄的子目錄名
+    int size, scale, max_size, min_size, threshold;
+    Icon_dir_type type;
+    Icon_file_set *file_sets; // 各基本目錄下該子目錄的圖標文件集，按需分配
+};
+typedef struct icon_dir_tag Icon_dir;
+
+/* GTK的icon-theme.cache是大端字節序的二進制文件，其中的偏移量都相對於文件
+ * 開頭，格式如下：
+ *     文件頭：  CARD16主版本號(1)、CARD16次版本號、CARD32散列表偏移量、
+ *               CARD32目錄列表偏移量
+ *     目錄列表：CARD32目錄數、CARD32目錄名偏移量[目錄數]
+ *     散列表：  CARD32桶數、CARD32圖標偏移量[桶數]
+ *     圖標：    CARD32同桶下一圖標偏移量、CARD32圖標名偏移量、
+ *               CARD32圖像列表偏移量
+ *     圖像列表：CARD32圖像數、{CARD16目錄索引、CARD16標志、CARD32數據偏移量}
+ *               [圖像數]
+ * 圖像標志的第0、1、2位分別表示有.xpm、.svg、.png文件。 */
+struct icon_theme_cache_tag // 映射到內存的icon-theme.cache
+{
+    const unsigned char *data; // 文件內容，沒有有效的緩存文件時爲NULL
+    size_t size; // 文件大小
+    uint32_t *dir_indexes; // 主題各子目錄在緩存的目錄列表中的索引，不在其中時爲ICON_CACHE_NONE
+};
+typedef struct icon_theme_cache_tag Icon_theme_cache;
+
+struct icon_theme_tag // 已解析的圖標主題
+{
+    char *name; // 主題名
+    Icon_dir *dirs; // 主題的子目錄，按index.theme中Directories的順序排列
+    size_t dir_n; // 子目錄數量
+    char **parents; // 以NULL結尾的父主題名列表，即Inherits鍵的值
+    Icon_theme_cache *caches; // 各基本目錄下該主題的icon-theme.cache，按需加載
+    struct icon_theme_tag *next;
+};
+typedef struct icon_theme_tag Icon_theme;
+
+static Icon_theme *themes=NULL; // 已解析的主題鏈表，沒有index.theme的主題亦在其中
+static char **base_dirs=NULL; // 以NULL結尾的基本目錄列表
+static size_t base_dir_n=0; // 基本目錄數量
+static Icon_file_set *fallback_file_sets=NULL; // 各基本目錄本身的圖標文件集
+
+static char *find_icon_helper(const char *name, int size, int scale, const char *theme, const char *context_dir, int depth);
+static char *lookup_icon(const char *name, int size, int scale, Icon_theme *theme, const char *context_dir);
+static unsigned int get_dir_icon_exts(Icon_theme *theme, size_t i, size_t j, const char *name);
+static char *get_icon_filename(const char *base_dir, const char *theme, const char *dir, const char *name, unsigned int exts);
+static char *lookup_fallback_icon(const char *name);
+static bool is_dir_match_size(const Icon_dir *dir, int size, int scale);
+static int get_dir_size_distance(const Icon_dir *dir, int size, int scale);
+static char **get_base_dirs(void);
+static Icon_theme *get_icon_theme(const char *name);
+static void load_index_theme(Icon_theme *theme);
+static void stamp_icon_theme(const Icon_theme *theme);
+static FILE *open_index_theme(const char *theme);
+static Icon_dir *find_icon_dir(Icon_theme *theme, const char *name);
+static void set_icon_dir_key(Icon_dir *dir, const char *key, const char *val);
+static void fix_icon_dir(Icon_dir *dir);
+static char **split_list(const char *val, size_t *n);
+static void free_list(char **list);
+static unsigned int get_icon_exts(Icon_file_set *set, const char *dir, const char *name);
+static void list_icon_files(Icon_file_set *set, const char *dir);
+static void add_icon_file(Icon_file_set *set, const char *filename, size_t len, unsigned int ext);
+static void rehash_icon_files(Icon_file_set *set);
+static void free_icon_file_sets(Icon_file_set *sets, size_t n);
+static int get_icon_ext_index(const char *filename);
+static void update_icon_file_set(Icon_file_set *set, const char *file, bool is_added);
+static void del_icon_file(Icon_file_set *set, const char *name, unsigned int ext);
+static void update_theme_dir(Icon_theme *theme, const char *file);
+static void update_theme_subdir(Icon_theme *theme, size_t j, const char *dir, const char *file, bool is_added);
+static void del_icon_theme(const char *name);
+static void free_icon_theme(Icon_theme *theme);
+static void load_icon_theme_cache(Icon_theme *theme, Icon_theme_cache *cache, const char *base_dir);
+static bool map_icon_theme_cache_dirs(const Icon_theme *theme, Icon_theme_cache *cache);
+static unsigned int get_cached_icon_exts(const Icon_theme_cache *cache, uint32_t dir_index, const char *name);
+static unsigned int get_cached_image_exts(const Icon_theme_cache *cache, uint32_t offset, uint32_t dir_index);
+static uint32_t get_icon_name_hash(const char *name);
+static uint32_t get_card16(const Icon_theme_cache *cache, size_t offset);
+static uint32_t get_card32(const Icon_theme_cache *cache, size_t offset);
+static const char *get_cache_string(const Icon_theme_cache *cache, size_t offset);
+static void free_icon_theme_caches(Icon_theme_cache *caches, size_t n);
+
+/* 根據圖標名稱、尺寸、縮放比例和規範中context對應的目錄名來搜索圖標文件全名。
+ * context_dir的取值參見以下規範中的Directory列：
+ * specifications.freedesktop.org/icon-naming-spec/icon-naming-spec-latest.html
+ * 當context_dir爲空指針時，即爲通配。返回的文件名由調用者釋放。搜索結果（包
+ * 括找不到圖標）會存入磁盤緩存，此後啓動時不必再搜索主題。 */
+char *find_icon(const char *name, int size, int scale, const char *context_dir)
+{
+    char *filename=NULL;
+    if(!name)
+        return NULL;
+    get_base_dirs(); // 確保已打開磁盤緩存
+    if(find_cached_icon(CUR_ICON_THEME, name, size, scale, context_dir, &filename))
+        return filename;
+    // 規範建議先找基本目錄，然後找hicolor，最後找後備目錄
+    if( !(filename=find_icon_helper(name, size, scale, CUR_ICON_THEME, context_dir, 0))
+        && !(filename=find_icon_helper(name, size, scale, "hicolor", context_dir, 0)))
+        filename=lookup_fallback_icon(name);
+    add_cached_icon(CUR_ICON_THEME, name, size, scale, context_dir, filename);
+    return filename;
+}
+
+static char *find_icon_helper(const char *name, int size, int scale, const char *theme, const char *context_dir, int depth)
+{
+    char *filename=NULL;
+    Icon_theme *t=get_icon_theme(theme);
+
+    if((filename=lookup_icon(name, size, scale, t, context_dir)))
+        return filename;
+    // 規範建議在給定主題中找不到匹配的圖標時，遞歸搜索其父主題列表
+    if(depth < ICON_THEME_DEPTH_MAX)
+        for(char **p=t->parents; p && *p; p++)
+            if((filename=find_icon_helper(name, size, scale, *p, context_dir, depth+1)))
+                return filename;
+    return NULL;
+}
+
+/* 只有確定存在圖標時才拼接文件名，同一目錄下有多種格式的同名圖標時按
+ * ICON_EXT的順序取第一種 */
+static char *lookup_icon(const char *name, int size, int scale, Icon_theme *theme, const char *context_dir)
+{
+    int min=INT_MAX, d=0;
+    char **b=get_base_dirs(), *closest_filename=NULL;
+
+    // 規範建議先搜索完全匹配的圖標，然後搜索尺寸最接近的圖標
+    for(size_t i=0; i<theme->dir_n; i++)
+    {
+        Icon_dir *dir=theme->dirs+i;
+        if(context_dir && !strstr(dir->name, context_dir))
+            continue;
+        for(size_t j=0; j<base_dir_n; j++)
+        {
+            unsigned int exts=get_dir_icon_exts(theme, i, j, name);
+            if(!exts)
+                continue;
+            if(is_dir_match_size(dir, size, scale))
+                return free(closest_filename),
+                    get_icon_filename(b[j], theme->name, dir->name, name, exts);
+            if((d=get_dir_size_distance(dir, size, scale)) < min)
+            {
+                free(closest_filename), min=d;
+                closest_filename=get_icon_filename(b[j], theme->name, dir->name, name, exts);
+            }
+        }
+    }
+    return closest_filename;
+}
+
+/* 返回第j個基本目錄下主題theme的第i個子目錄中名爲name的圖標的擴展名位掩
+ * 碼。有有效的icon-theme.cache時查緩存，否則查列出的目錄的圖標文件集。 */
+static unsigned int get_dir_icon_exts(Icon_theme *theme, size_t i, size_t j, const char *name)
+{
+    char **b=get_base_dirs(), *dirname=NULL;
+    Icon_dir *dir=theme->dirs+i;
+
+    if(!theme->caches)
+    {
+        theme->caches=malloc_s(MAX(base_dir_n, 1)*sizeof(Icon_theme_cache));
+        for(size_t k=0; k<base_dir_n; k++)
+            load_icon_theme_cache(theme, theme->caches+k, b[k]);
+    }
+    if(theme->caches[j].data)
+        return get_cached_icon_exts(theme->caches+j, theme->caches[j].dir_indexes[i], name);
+
+    if(!dir->file_sets)
+    {
+        dir->file_sets=malloc_s(MAX(base_dir_n, 1)*sizeof(Icon_file_set));
+        memset(dir->file_sets, 0, MAX(base_dir_n, 1)*sizeof(Icon_file_set));
+    }
+    Icon_file_set *set=dir->file_sets+j;
+    if(!set->is_listed)
+    {
+        dirname=copy_strings(b[j], "/", theme->name, "/", dir->name, NULL);
+        list_icon_files(set, dirname);
+        free(dirname);
+    }
+    return get_icon_exts(set, NULL, name);
+}
+
+/* 由擴展名位掩碼中的第一種擴展名拼接圖標文件全名，theme和dir爲空指針時拼接
+ * 後備圖標的文件名 */
+static char *get_icon_filename(const char *base_dir, const char *theme, const char *dir, const char *name, unsigned int exts)
+{
+    size_t i=0;
+    while(!(exts & 1U<<i))
+        i++;
+    if(theme && dir)
+        return copy_strings(base_dir, "/", theme, "/", dir, "/", name, ICON_EXT[i], NULL);
+    return copy_strings(base_dir, "/", name, ICON_EXT[i], NULL);
+}
+
+static char *lookup_fallback_icon(const char *name)
+{
+    char **b=get_base_dirs();
+    if(!fallback_file_sets)
+    {
+        fallback_file_sets=malloc_s(MAX(base_dir_n, 1)*sizeof(Icon_file_set));
+        memset(fallback_file_sets, 0, MAX(base_dir_n, 1)*sizeof(Icon_file_set));
+    }
+    // 規範規定後備圖標路徑爲：基本目錄/圖標名.擴展名
+    for(size_t i=0; i<base_dir_n; i++)
+    {
+        unsigned int exts=get_icon_exts(fallback_file_sets+i, b[i], name);
+        if(exts)
+            return get_icon_filename(b[i], NULL, NULL, name, exts);
+    }
+    return NULL;
+}
+
+static bool is_dir_match_size(const Icon_dir *dir, int size, int scale)
+{
+    if(dir->scale != scale)
+        return false;
+    switch(dir->type)
+    {
+        case FIXED_ICON_DIR:
+            return dir->size == size;
+        case SCALED_ICON_DIR:
+            return dir->min_size<=size && size<=dir->max_size;
+        case THRESHOLD_ICON_DIR:
+            return dir->size-dir->threshold<=size && size<=dir->size+dir->threshold;
+    }
+    return false;
+}
+
+static int get_dir_size_distance(const Icon_dir *dir, int size, int scale)
+{
+    int s=size*scale, low=0, high=0;
+    switch(dir->type)
+    {
+        case FIXED_ICON_DIR:
+            return abs(dir->size*dir->scale-s);
+        case SCALED_ICON_DIR:
+            low=dir->min_size*dir->scale, high=dir->max_size*dir->scale;
+            break;
+        case THRESHOLD_ICON_DIR:
+            low=(dir->size-dir->threshold)*dir->scale;
+            high=(dir->size+dir->threshold)*dir->scale;
+            break;
+    }
+    return s<low ? low-s : s>high ? s-high : 0;
+}
+
+/* 規範規定依次搜索如下三個基本目錄：
+ * $HOME/.icons、$XDG_DATA_DIRS/icons、/usr/share/pixmaps */
+static char **get_base_dirs(void)
+{
+    if(base_dirs)
+        return base_dirs;
+
+    const char *xdg=getenv("XDG_DATA_DIRS");
+    if(!xdg || !*xdg) // XDG基本目錄規範規定的默認值
+        xdg="/usr/local/share:/usr/share";
+    size_t i=0, n=0;
+    char **dirs=split_list(xdg, &n), *home=getenv("HOME");
+    for(char **p=dirs; *p; p++)
+    {
+        char *dir=*p;
+        *p=copy_strings(dir, "/icons", NULL);
+        free(dir);
+    }
+    base_dirs=malloc_s((n+3)*sizeof(char *));
+    if(home)
+        base_dirs[i++]=copy_strings(home, "/.icons", NULL);
+    for(size_t j=0; j<n; j++)
+        base_dirs[i++]=dirs[j];
+    base_dirs[i++]=copy_string("/usr/share/pixmaps");
+    base_dirs[i]=NULL;
+    base_dir_n=i;
+    free(dirs);
+    open_icon_cache(base_dirs);
+    for(char **b=base_dirs; *b; b++) // 後備圖標就在基本目錄中
+        add_icon_cache_stamp(*b), add_watch(*b, ICON_THEME_WATCH);
+    return base_dirs;
+}
+
+static Icon_theme *get_icon_theme(const char *name)
+{
+    for(Icon_theme *t=themes; t; t=t->next)
+        if(strcmp(t->name, name) == 0)
+            return t;
+
+    Icon_theme *t=malloc_s(sizeof(Icon_theme));
+    *t=(Icon_theme){copy_string(name), NULL, 0, NULL, NULL, themes};
+    load_index_theme(t);
+    stamp_icon_theme(t);
+    return themes=t;
+}
+
+/* 解析主題的index.theme。規範對其格式提出詳細要求，實際上我所見過的所有這
+ * 類文件都沒有不必要的空白符，故也不考慮其存在多餘空白符。 */
+static void load_index_theme(Icon_theme *theme)
+{
+    FILE *fp=open_index_theme(theme->name);
+    if(fp == NULL)
+        return;
+
+    char *line=NULL, *val=NULL;
+    size_t size=0;
+    Icon_dir *dir=NULL;
+    bool is_main=false; // 當前是否位於[Icon Theme]段
+    while(getline(&line, &size, fp) != -1)
+    {
+        line[strcspn(line, "\r\n")]='\0';
+        if(line[0] == '[')
+        {
+            char *end=strchr(line, ']');
+            if(end)
+                *end='\0';
+            is_main=!strcmp(line+1, "Icon Theme");
+            dir=is_main ? NULL : find_icon_dir(theme, line+1);
+        }
+        else if((val=strchr(line, '=')))
+        {
+            *val++='\0';
+            if(is_main && !theme->dirs && !strcmp(line, "Directories"))
+            {
+                char **names=split_list(val, &theme->dir_n);
+                theme->dirs=malloc_s(MAX(theme->dir_n, 1)*sizeof(Icon_dir));
+                for(size_t i=0; i<theme->dir_n; i++)
+                    theme->dirs[i]=(Icon_dir){names[i], 0, 0, 0, 0, 0, THRESHOLD_ICON_DIR, NULL};
+                free(names);
+            }
+            else if(is_main && !theme->parents && !strcmp(line, "Inherits"))
+                theme->parents=split_list(val, NULL);
+            else if(dir)
+                set_icon_dir_key(dir, line, val);
+        }
+    }
+    free(line);
+    fclose(fp);
+    for(size_t i=0; i<theme->dir_n; i++)
+        fix_icon_dir(theme->dirs+i);
+}
+
+/* 在磁盤緩存中記錄各基本目錄下的主題目錄及其index.theme的修改時間。安裝圖
+ * 標後一般會在主題目錄中重建icon-theme.cache，故主題目錄的修改時間足以反映
+ * 其子目錄中圖標的增減。 */
+static void stamp_icon_theme(const Icon_theme *theme)
+{
+    for(char **b=get_base_dirs(); *b; b++)
+    {
+        char *dir=copy_strings(*b, "/", theme->name, NULL),
+             *index=copy_strings(dir, "/index.theme", NULL);
+        add_icon_cache_stamp(dir);
+        add_icon_cache_stamp(index);
+        add_watch(dir, ICON_THEME_WATCH);
+        free(dir), free(index);
+    }
+}
+
+/* 規範約定的主題文件全名爲：基本目錄/主題/index.theme，取第一個存在的 */
+static FILE *open_index_theme(const char *theme)
+{
+    for(char **b=get_base_dirs(); *b; b++)
+    {
+        char *filename=copy_strings(*b, "/", theme, "/index.theme", NULL);
+        FILE *fp=fopen(filename, "r");
+        free(filename);
+        if(fp)
+            return fp;
+    }
+    return NULL;
+}
+
+/* 規範要求Directories鍵在各目錄段之前，故解析目錄段時子目錄列表已經建立 */
+static Icon_dir *find_icon_dir(Icon_theme *theme, const char *name)
+{
+    for(size_t i=0; i<theme->dir_n; i++)
+        if(strcmp(theme->dirs[i].name, name) == 0)
+            return theme->dirs+i;
+    return NULL;
+}
+
+static void set_icon_dir_key(Icon_dir *dir, const char *key, const char *val)
+{
+    if(!strcmp(key, "Size"))
+        dir->size=atoi(val);
+    else if(!strcmp(key, "Scale"))
+        dir->scale=atoi(val);
+    else if(!strcmp(key, "MaxSize"))
+        dir->max_size=atoi(val);
+    else if(!strcmp(key, "MinSize"))
+        dir->min_size=atoi(val);
+    else if(!strcmp(key, "Threshold"))
+        dir->threshold=atoi(val);
+    else if(!strcmp(key, "Type"))
+        dir->type = !strcmp(val, "Fixed") ? FIXED_ICON_DIR :
+            !strcmp(val, "Scaled") ? SCALED_ICON_DIR : THRESHOLD_ICON_DIR;
+    // Context鍵目前用不上
+}
+
+static void fix_icon_dir(Icon_dir *dir)
+{
+    if(dir->scale == 0)
+        dir->scale=1;
+    if(dir->max_size == 0)
+        dir->max_size=dir->size;
+    if(dir->min_size == 0)
+        dir->min_size=dir->size;
+    if(dir->threshold == 0)
+        dir->threshold=2;
+}
+
+/* 把以逗號或冒號分隔的列表拆分爲以NULL結尾的字符串數組，n非空時返回項數 */
+static char **split_list(const char *val, size_t *n)
+{
+    size_t i=0, cap=1;
+    for(const char *p=val; *p; p++)
+        if(*p==',' || *p==':')
+            cap++;
+
+    char **list=malloc_s((cap+1)*sizeof(char *));
+    for(size_t len=0; *val; val+=len+(val[len]!='\0'))
+        if((len=strcspn(val, ",:")))
+            list[i]=malloc_s(len+1), memcpy(list[i], val, len), list[i++][len]='\0';
+    list[i]=NULL;
+    if(n)
+        *n=i;
+    return list;
+}
+
+static void free_list(char **list)
+{
+    for(char **p=list; p && *p; p++)
+        free(*p);
+    free(list);
+}
+
+/* 返回目錄中名爲name的圖標已有的擴展名位掩碼，沒有則返回0。dir非空時，若
+ * 尚未列出目錄，則先列出它。 */
+static unsigned int get_icon_exts(Icon_file_set *set, const char *dir, const char *name)
+{
+    if(!set->is_listed && dir)
+        list_icon_files(set, dir);
+    if(!set->file_n)
+        return 0;
+    for(Icon_file *f=set->buckets[get_string_hash(name)%set->bucket_n]; f; f=f->next)
+        if(!strcmp(f->name, name))
+            return f->exts;
+    return 0;
+}
+
+/* 只記錄擴展名符合規範的文件，目錄不存在時得到空集，以後也不再嘗試列出它。
+ * 目錄中增刪文件不會改變主題目錄的修改時間，故也要記錄所列目錄（包括不存在
+ * 的）的修改時間，以免gwm未運行時新安裝的圖標被緩存的搜索結果掩蓋。 */
+static void list_icon_files(Icon_file_set *set, const char *dir)
+{
+    DIR *d=opendir(dir);
+    set->is_listed=true;
+    add_icon_cache_stamp(dir);
+    if(!d)
+        return;
+
+    add_watch(dir, ICON_THEME_WATCH);
+    for(struct dirent *e=readdir(d); e; e=readdir(d))
+    {
+        int i=get_icon_ext_index(e->d_name);
+        if(i != -1)
+            add_icon_file(set, e->d_name, strrchr(e->d_name, '.')-e->d_name, i);
+    }
+    closedir(d);
+}
+
+/* 返回文件名的擴展名在ICON_EXT中的索引，不是圖標文件時返回-1 */
+static int get_icon_ext_index(const char *filename)
+{
+    const char *ext=strrchr(filename, '.');
+    for(size_t i=0, n=ARRAY_NUM(ICON_EXT); ext && ext!=filename && i<n; i++)
+        if(!strcmp(ext, ICON_EXT[i]))
+            return i;
+    return -1;
+}
+
+static void add_icon_file(Icon_file_set *set, const char *filename, size_t len, unsigned int ext)
+{
+    char *name=malloc_s(len+1);
+    memcpy(name, filename, len), name[len]='\0';
+    if(set->file_n >= set->bucket_n)
+        rehash_icon_files(set);
+
+    Icon_file **pp=set->buckets+get_string_hash(name)%set->bucket_n;
+    for(Icon_file *f=*pp; f; f=f->next)
+    {
+        if(!strcmp(f->name, name))
+        {
+            free(name), f->exts|=1U<<ext;
+            return;
+        }
+    }
+
+    Icon_file *f=malloc_s(sizeof(Icon_file));
+    *f=(Icon_file){name, 1U<<ext, *pp};
+    *pp=f, set->file_n++;
+}
+
+/* 使桶數翻倍，讓每個桶的平均文件數不超過1 */
+static void rehash_icon_files(Icon_file_set *set)
+{
+    size_t n=MAX(set->bucket_n*2, ICON_FILE_BUCKET_N_MIN);
+    Icon_file **buckets=malloc_s(n*sizeof(Icon_file *));
+    memset(buckets, 0, n*sizeof(Icon_file *));
+    for(size_t i=0; i<set->bucket_n; i++)
+    {
+        for(Icon_file *f=set->buckets[i], *next=NULL; f; f=next)
+        {
+            Icon_file **pp=buckets+get_string_hash(f->name)%n;
+            next=f->next, f->next=*pp, *pp=f;
+        }
+    }
+    free(set->buckets);
+    set->buckets=buckets, set->bucket_n=n;
+}
+
+/* 增量更新已列出的圖標文件集，未列出的目錄以後列出時自然是最新的 */
+static void update_icon_file_set(Icon_file_set *set, const char *file, bool is_added)
+{
+    int i=get_icon_ext_index(file);
+    if(!set->is_listed || i==-1)
+        return;
+
+    size_t len=strrchr(file, '.')-file;
+    if(is_added)
+        add_icon_file(set, file, len, i);
+    else
+    {
+        char *name=malloc_s(len+1);
+        memcpy(name, file, len), name[len]='\0';
+        del_icon_file(set, name, i);
+        free(name);
+    }
+}
+
+/* 刪除圖標的一種擴展名，沒有其他擴展名時刪除圖標 */
+static void del_icon_file(Icon_file_set *set, const char *name, unsigned int ext)
+{
+    if(!set->file_n)
+        return;
+    for(Icon_file **pp=set->buckets+get_string_hash(name)%set->bucket_n; *pp; pp=&(*pp)->next)
+    {
+        Icon_file *f=*pp;
+        if(!strcmp(f->name, name))
+        {
+            if((f->exts&=~(1U<<ext)) == 0)
+                *pp=f->next, free(f->name), free(f), set->file_n--;
+            return;
+        }
+    }
+}
+
+static void free_icon_file_sets(Icon_file_set *sets, size_t n)
+{
+    for(size_t i=0; sets && i<n; i++)
+    {
+        for(size_t j=0; j<sets[i].bucket_n; j++)
+        {
+            for(Icon_file *f=sets[i].buckets[j], *next=NULL; f; f=next)
+                next=f->next, free(f->name), free(f);
+        }
+        free(sets[i].buckets);
+    }
+    free(sets);
+}
+
+/* 與GTK一樣，只使用修改時間不早於主題目錄的緩存文件。更新主題後若未重新生
+ * 成緩存，則缺少的圖標在緩存中找不到，故舊緩存不可用。 */
+static void load_icon_theme_cache(Icon_theme *theme, Icon_theme_cache *cache, const char *base_dir)
+{
+    char *dir=copy_strings(base_dir, "/", theme->name, NULL),
+         *filename=copy_strings(dir, "/icon-theme.cache", NULL);
+    struct stat dir_st, st;
+    void *data=MAP_FAILED;
+    int fd=-1;
+
+    *cache=(Icon_theme_cache){NULL, 0, NULL};
+    if( !stat(dir, &dir_st) && (fd=open(filename, O_RDONLY|O_CLOEXEC)) != -1
+        && !fstat(fd, &st) && st.st_size >= 12
+        && ( st.st_mtim.tv_sec > dir_st.st_mtim.tv_sec
+            || ( st.st_mtim.tv_sec == dir_st.st_mtim.tv_sec
+                && st.st_mtim.tv_nsec >= dir_st.st_mtim.tv_nsec)))
+        data=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(fd != -1)
+        close(fd);
+    free(dir), free(filename);
+    if(data == MAP_FAILED)
+        return;
+
+    cache->data=data, cache->size=st.st_size;
+    if(get_card16(cache, 0)!=1 || !map_icon_theme_cache_dirs(theme, cache))
+    {
+        munmap(data, st.st_size);
+        free(cache->dir_indexes);
+        *cache=(Icon_theme_cache){NULL, 0, NULL};
+    }
+}
+
+/* 建立主題子目錄到緩存目錄列表索引的映射，緩存格式錯誤時返回假 */
+static bool map_icon_theme_cache_dirs(const Icon_theme *theme, Icon_theme_cache *cache)
+{
+    uint32_t offset=get_card32(cache, 8), n=get_card32(cache, offset);
+    if(n == ICON_CACHE_NONE)
+        return false;
+
+    cache->dir_indexes=malloc_s(MAX(theme->dir_n, 1)*sizeof(uint32_t));
+    for(size_t i=0; i<theme->dir_n; i++)
+        cache->dir_indexes[i]=ICON_CACHE_NONE;
+    for(uint32_t k=0; k<n; k++)
+    {
+        const char *name=get_cache_string(cache, get_card32(cache, offset+4+4*(size_t)k));
+        if(!name)
+            return false;
+        for(size_t i=0; i<theme->dir_n; i++)
+            if(!strcmp(theme->dirs[i].name, name))
+                cache->dir_indexes[i]=k;
+    }
+    return true;
+}
+
+/* 返回緩存中第dir_index個目錄下名爲name的圖標的擴展名位掩碼 */
+static unsigned int get_cached_icon_exts(const Icon_theme_cache *cache, uint32_t dir_index, const char *name)
+{
+    uint32_t offset=get_card32(cache, 4), n=get_card32(cache, offset);
+    if(dir_index==ICON_CACHE_NONE || n==0 || n==ICON_CACHE_NONE)
+        return 0;
+
+    uint32_t icon=get_card32(cache, offset+4+4*(size_t)(get_icon_name_hash(name)%n));
+    // 限制遍歷次數，以免損壞的緩存文件中的循環鏈表導致死循環
+    for(size_t i=0; icon!=ICON_CACHE_NONE && i<cache->size/12; i++)
+    {
+        const char *s=get_cache_string(cache, get_card32(cache, icon+4));
+        if(s && !strcmp(s, name))
+            return get_cached_image_exts(cache, get_card32(cache, icon+8), dir_index);
+        icon=get_card32(cache, icon);
+    }
+    return 0;
+}
+
+static unsigned int get_cached_image_exts(const Icon_theme_cache *cache, uint32_t offset, uint32_t dir_index)
+{
+    uint32_t n=get_card32(cache, offset);
+    for(uint32_t i=0; n!=ICON_CACHE_NONE && i<n; i++)
+    {
+        size_t image=offset+4+8*(size_t)i;
+        uint32_t dir=get_card16(cache, image), flags=get_card16(cache, image+2);
+        if(dir == ICON_CACHE_NONE)
+            break;
+        if(dir == dir_index) // 轉換爲ICON_EXT的順序：.png、.svg、.xpm
+            return (flags&4 ? 1 : 0) | (flags&2 ? 2 : 0) | (flags&1 ? 4 : 0);
+    }
+    return 0;
+}
+
+/* 與GTK所用的散列函數相同，須按有符號字符計算 */
+static uint32_t get_icon_name_hash(const char *name)
+{
+    const signed char *p=(const signed char *)name;
+    uint32_t h=*p;
+    if(h)
+        for(p++; *p; p++)
+            h=(h<<5)-h+*p;
+    return h;
+}
+
+/* 以下讀取函數在越界時返回ICON_CACHE_NONE或NULL */
+static uint32_t get_card16(const Icon_theme_cache *cache, size_t offset)
+{
+    if(offset+2 > cache->size)
+        return ICON_CACHE_NONE;
+    const unsigned char *p=cache->data+offset;
+    return (uint32_t)p[0]<<8 | p[1];
+}
+
+static uint32_t get_card32(const Icon_theme_cache *cache, size_t offset)
+{
+    if(offset+4 > cache->size)
+        return ICON_CACHE_NONE;
+    const unsigned char *p=cache->data+offset;
+    return (uint32_t)p[0]<<24 | (uint32_t)p[1]<<16 | (uint32_t)p[2]<<8 | p[3];
+}
+
+static const char *get_cache_string(const Icon_theme_cache *cache, size_t offset)
+{
+    if(offset >= cache->size || !memchr(cache->data+offset, '\0', cache->size-offset))
+        return NULL;
+    return (const char *)cache->data+offset;
+}
+
+static void free_icon_theme_caches(Icon_theme_cache *caches, size_t n)
+{
+    for(size_t i=0; caches && i<n; i++)
+    {
+        if(caches[i].data)
+            munmap((void *)caches[i].data, caches[i].size);
+        free(caches[i].dir_indexes);
+    }
+    free(caches);
+}
+
+/* 根據inotify監視到的文件變化增量更新：dir是變化的文件所在的目錄，file是
+ * 文件名，is_added表示文件是新增（含改寫）的還是刪除的；dir爲NULL時表示事件
+ * 丟失，只能全部重建。只有受影響的圖標的磁盤緩存項會失效，而主題結構變化時，
+ * 所有搜索結果都可能改變，只能使全部緩存項失效。 */
+void update_icon_themes(const char *dir, const char *file, bool is_added)
+{
+    if(!dir || !file)
+    {
+        clear_icon_themes();
+        del_cached_icons(NULL);
+        return;
+    }
+
+    char **b=get_base_dirs();
+    for(size_t j=0; j<base_dir_n; j++)
+    {
+        size_t len=strlen(b[j]);
+        const char *rest=dir+len;
+        if(strncmp(dir, b[j], len) || (*rest && *rest!='/'))
+            continue;
+        if(!*rest) // 基本目錄本身：後備圖標或主題目錄有變化
+        {
+            if(get_icon_ext_index(file) == -1)
+                del_icon_theme(file);
+            else if(fallback_file_sets)
+                update_icon_file_set(fallback_file_sets+j, file, is_added);
+        }
+        for(Icon_theme *t=themes; *rest && t; t=t->next)
+        {
+            size_t n=strlen(t->name);
+            if(strncmp(rest+1, t->name, n) || (rest[n+1] && rest[n+1]!='/'))
+                continue;
+            if(rest[n+1])
+                update_theme_subdir(t, j, rest+n+2, file, is_added);
+            else
+                update_theme_dir(t, file);
+            break;
+        }
+        char *name=copy_strings(dir, "/", file, NULL);
+        refresh_icon_cache_stamp(dir), refresh_icon_cache_stamp(name);
+        free(name);
+        if(get_icon_ext_index(file) != -1)
+        {
+            name=copy_string(file);
+            *strrchr(name, '.')='\0';
+            del_cached_icons(name);
+            free(name);
+        }
+        return;
+    }
+}
+
+/* 主題目錄中的index.theme或icon-theme.cache有變化 */
+static void update_theme_dir(Icon_theme *theme, const char *file)
+{
+    if(!strcmp(file, "index.theme"))
+        del_icon_theme(theme->name);
+    else if(!strcmp(file, "icon-theme.cache") && theme->caches)
+    {
+        free_icon_theme_caches(theme->caches, base_dir_n);
+        theme->caches=NULL; // 下次搜索時重新加載
+        del_cached_icons(NULL);
+    }
+}
+
+static void update_theme_subdir(Icon_theme *theme, size_t j, const char *dir, const char *file, bool is_added)
+{
+    Icon_dir *d=find_icon_dir(theme, dir);
+    if(d && d->file_sets)
+        update_icon_file_set(d->file_sets+j, file, is_added);
+    /* 子目錄的圖標有增刪而緩存未重新生成，則緩存已過時，改爲列出目錄 */
+    if(theme->caches && theme->caches[j].data)
+    {
+        munmap((void *)theme->caches[j].data, theme->caches[j].size);
+        free(theme->caches[j].dir_indexes);
+        theme->caches[j]=(Icon_theme_cache){NULL, 0, NULL};
+    }
+}
+
+/* 刪除已解析的主題，下次用到時重新解析 */
+static void del_icon_theme(const char *name)
+{
+    for(Icon_theme **pp=&themes; *pp; pp=&(*pp)->next)
+    {
+        if(!strcmp((*pp)->name, name))
+        {
+            Icon_theme *t=*pp;
+            *pp=t->next;
+            free_icon_theme(t);
+            del_cached_icons(NULL);
+            return;
+        }
+    }
+}
+
+static void free_icon_theme(Icon_theme *theme)
+{
+    for(size_t i=0; i<theme->dir_n; i++)
+        free(theme->dirs[i].name), free_icon_file_sets(theme->dirs[i].file_sets, base_dir_n);
+    free(theme->dirs);
+    free_list(theme->parents);
+    free_icon_theme_caches(theme->caches, base_dir_n);
+    free(theme->name);
+    free(theme);
+}
+
+/* 釋放已解析的主題、圖標文件集、icon-theme.cache和基本目錄列表 */
+void clear_icon_themes(void)
+{
+    for(Icon_theme *t=themes, *next=NULL; t; t=next)
+        next=t->next, free_icon_theme(t);
+    themes=NULL;
+    free_icon_file_sets(fallback_file_sets, base_dir_n);
+    fallback_file_sets=NULL;
+    free_list(base_dirs);
+    base_dirs=NULL, base_dir_n=0;
+}
@@ -20,13 +20,17 @@
 #include "font.h"
 #include "func.h"
 #include "grab.h"
+#include "icon_loader.h"
 #include "layout.h"
 #include "menu.h"
 #include "misc.h"
+#include "timer.h"
+#include "watch.h"
 
 static void set_locale(WM *wm);
 static void set_atoms(WM *wm);
 static void create_cursors(WM *wm);
+static void create_label_pixmaps(WM *wm);
 static void create_taskbar(WM *wm);
 static void create_taskbar_buttons(WM *wm);
 static void create_icon_area(WM *wm);
@@ -36,6 +40,7 @@ static void create_run_cmd_entry(WM *wm);
 static void create_hint_win(WM *wm);
 static void create_clients(WM *wm);
 static void init_wallpaper_files(WM *wm);
+static void init_imlib(WM *wm);
 
 void init_wm(WM *wm)
 {
@@ -47,12 +52,27 @@ void init_wm(WM *wm)
     wm->screen=DefaultScreen(wm->display);
     wm->screen_width=DisplayWidth(wm->display, wm->screen);
     wm->screen_height=DisplayHeight(wm->display, wm->screen);
-    wm->mod_map=XGetModifierMapping(wm->display);
+    update_modifier_masks(wm);
     wm->root_win=RootWindow(wm->display, wm->screen);
     wm->gc=XCreateGC(wm->display, wm->root_win, 0, NULL);
     wm->visual=DefaultVisual(wm->display, wm->screen);
     wm->colormap=DefaultColormap(wm->display, wm->screen);
     wm->focus_mode=DEFAULT_FOCUS_MODE;
+    wm->signal_fd=-1;
+    init_timers(wm);
+    init_imlib(wm); // 須先於init_icon_loader，因加載線程會使用imlib2的上下文
+#if USE_IMAGE_ICON
+    init_icon_loader(wm);
+#else
+    wm->icon_load_fd=-1;
+#endif
+    init_watches(wm);
+    wm->client_ctx=XUniqueContext();
+    wm->widget_ctx=XUniqueContext();
+    wm->xft_draw_ctx=XUniqueContext();
+    wm->repaint_ctx=XUniqueContext();
+    wm->damage_ctx=XUniqueContext();
+    set_win_index(wm, wm->root_win, NULL, ROOT_WIN);
 
 #ifdef WALLPAPER_PATHS
     init_wallpaper_files(wm);
@@ -65,6 +85,7 @@ void init_wm(WM *wm)
     alloc_color(wm);
     create_cursors(wm);
     XDefineCursor(wm->display, wm->root_win, wm->cursors[NO_OP]);
+    create_label_pixmaps(wm);
     create_taskbar(wm);
     create_cmd_center(wm);
     create_run_cmd_entry(wm);
@@ -103,6 +124,30 @@ static void create_cursors(WM *wm)
         wm->cursors[i]=XCreateFontCursor(wm->display, CURSOR_SHAPE[i]);
 }
 
+/* 任務欄按鈕、操作中心菜單項、標題按鈕的文字在運行時不變，故在啓動時就按
+ * 它們可能用到的各種背景色預先繪制好標籤像素圖 */
+static void create_label_pixmaps(WM *wm)
+{
+    Widget_color taskbar[]={NORMAL_TASKBAR_BUTTON_COLOR,
+        CHOSEN_TASKBAR_BUTTON_COLOR, ENTERED_NORMAL_BUTTON_COLOR},
+        title[]={NORMAL_TITLE_BUTTON_COLOR, CURRENT_TITLE_BUTTON_COLOR},
+        cmd_center[]={CMD_CENTER_COLOR, ENTERED_NORMAL_BUTTON_COLOR};
+
+    for(Widget_type t=TASKBAR_BUTTON_BEGIN; t<=TASKBAR_BUTTON_END; t++)
+        for(size_t i=0; i<ARRAY_NUM(taskbar); i++)
+            get_widget_label_pixmap(wm, t, taskbar[i]);
+    for(Widget_type t=CMD_CENTER_ITEM_BEGIN; t<=CMD_CENTER_ITEM_END; t++)
+        for(size_t i=0; i<ARRAY_NUM(cmd_center); i++)
+            get_widget_label_pixmap(wm, t, cmd_center[i]);
+    for(Widget_type t=TITLE_BUTTON_BEGIN; t<=TITLE_BUTTON_END; t++)
+    {
+        for(size_t i=0; i<ARRAY_NUM(title); i++)
+            get_widget_label_pixmap(wm, t, title[i]);
+        get_widget_label_pixmap(wm, t, t==CLOSE_BUTTON ?
+            ENTERED_CLOSE_BUTTON_COLOR : ENTERED_NORMAL_BUTTON_COLOR);
+    }
+}
+
 static void create_taskbar(WM *wm)
 {
     Taskbar *b=&wm->taskbar;
@@ -125,13 +170,14 @@ static void create_taskbar_buttons(WM *wm)
     Taskbar *b=&wm->taskbar;
     for(size_t i=0; i<TASKBAR_BUTTON_N; i++)
     {
-        unsigned long color = is_chosen_button(wm, TASKBAR_BUTTON_BEGIN+i) ?
-            wm->widget_color[CHOSEN_TASKBAR_BUTTON_COLOR].pixel :
-            wm->widget_color[NORMAL_TASKBAR_BUTTON_COLOR].pixel ;
+        Widget_color color = is_chosen_button(wm, TASKBAR_BUTTON_BEGIN+i) ?
+            CHOSEN_TASKBAR_BUTTON_COLOR : NORMAL_TASKBAR_BUTTON_COLOR;
         b->buttons[i]=XCreateSimpleWindow(wm->display, b->win,
-            TASKBAR_BUTTON_WIDTH*i, 0,
-            TASKBAR_BUTTON_WIDTH, TASKBAR_BUTTON_HEIGHT, 0, 0, color);
+            TASKBAR_BUTTON_WIDTH*i, 0, TASKBAR_BUTTON_WIDTH,
+            TASKBAR_BUTTON_HEIGHT, 0, 0, wm->widget_color[color].pixel);
         XSelectInput(wm->display, b->buttons[i], BUTTON_EVENT_MASK);
+        set_win_index(wm, b->buttons[i], NULL, TASKBAR_BUTTON_BEGIN+i);
+        update_label_widget(wm, b->buttons[i], TASKBAR_BUTTON_BEGIN+i, color);
     }
 }
 
@@ -156,6 +202,7 @@ static void create_status_area(WM *wm)
         b->w-b->status_area_w, 0, b->status_area_w, b->h,
         0, 0, wm->widget_color[STATUS_AREA_COLOR].pixel);
     XSelectInput(wm->display, b->status_area, ExposureMask);
+    set_win_index(wm, b->status_area, NULL, STATUS_AREA);
 }
 
 static void create_cmd_center(WM *wm)
@@ -165,6 +212,12 @@ static void create_cmd_center(WM *wm)
     unsigned long color=wm->widget_color[CMD_CENTER_COLOR].pixel;
 
     create_menu(wm, &wm->cmd_center, n, col, w, h, color);
+    for(size_t i=0; i<n; i++)
+    {
+        set_win_index(wm, wm->cmd_center.items[i], NULL, CMD_CENTER_ITEM_BEGIN+i);
+        update_label_widget(wm, wm->cmd_center.items[i],
+            CMD_CENTER_ITEM_BEGIN+i, CMD_CENTER_COLOR);
+    }
 }
 
 static void create_run_cmd_entry(WM *wm)
@@ -173,6 +226,7 @@ static void create_run_cmd_entry(WM *wm)
     (wm->screen_height-RUN_CMD_ENTRY_HEIGHT)/2,
     RUN_CMD_ENTRY_WIDTH, RUN_CMD_ENTRY_HEIGHT};
     create_entry(wm, &wm->run_cmd, &r, RUN_CMD_ENTRY_HINT);
+    set_win_index(wm, wm->run_cmd.win, NULL, RUN_CMD_ENTRY);
 }
 
 static void create_hint_win(WM *wm)
@@ -181,6 +235,7 @@ static void create_hint_win(WM *wm)
         1, 0, 0, wm->widget_color[HINT_WIN_COLOR].pixel);
     set_override_redirect(wm, wm->hint_win);
     XSelectInput(wm->display, wm->hint_win, ExposureMask);
+    set_win_index(wm, wm->hint_win, NULL, HINT_WIN);
 }
 
 /* 生成帶表頭結點的雙向循環鏈表 */
@@ -205,7 +260,7 @@ static void create_clients(WM *wm)
     XFree(child);
 }
 
-void init_imlib(WM *wm)
+static void init_imlib(WM *wm)
 {
     imlib_context_set_dither(1);
     imlib_context_set_display(wm->display);
@@ -214,9 +269,8 @@ void init_imlib(WM *wm)
 
 static void init_wallpaper_files(WM *wm)
 {
-    const char *exts[]={"png", "jpg"};
-    size_t n=ARRAY_NUM(WALLPAPER_PATHS);
-    wm->wallpapers=get_files_in_dirs(WALLPAPER_PATHS, n, exts, 2, NOSORT, true);
+    size_t n=ARRAY_NUM(WALLPAPER_PATHS), m=ARRAY_NUM(WALLPAPER_EXTS);
+    wm->wallpapers=get_files_in_dirs(WALLPAPER_PATHS, n, WALLPAPER_EXTS, m, NOSORT, true);
     wm->cur_wallpaper=wm->wallpapers->next;
 }
 
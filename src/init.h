@@ -13,7 +13,6 @@
 #define INIT_H
 
 void init_wm(WM *wm);
-void init_imlib(WM *wm);
 void init_root_win_background(WM *wm);
 
 #endif
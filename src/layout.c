@@ -11,7 +11,7 @@
 
 #include "gwm.h"
 #include "layout.h"
-#include "font.h"
+#include "misc.h"
 #include "desktop.h"
 #include "client.h"
 
@@ -23,7 +23,6 @@ static void get_area_size(WM *wm, unsigned int *mw, unsigned int *mh, unsigned i
 static void fix_win_rect_for_frame(WM *wm);
 static bool should_fix_win_rect(WM *wm, Client *c);
 static void fix_cur_focus_client_rect(WM *wm);
-static void update_title_bar_layout(WM *wm);
 
 void change_layout(WM *wm, XEvent *e, Func_arg arg)
 {
@@ -40,17 +39,28 @@ void change_layout(WM *wm, XEvent *e, Func_arg arg)
             for(Client *c=wm->clients->next; c!=wm->clients; c=c->next)
                 if(is_on_cur_desktop(wm, c) && c->area_type==ICONIFY_AREA)
                     XMapWindow(d, c->frame), XUnmapWindow(d, c->icon->win);
-        update_layout(wm);
-        update_title_bar_layout(wm);
+        update_layout(wm); // 標題區尺寸隨布局而變，由move_resize_client調整
         update_taskbar_buttons(wm);
     }
 }
 
+/* 只把當前虛擬桌面標記爲需要更新布局，實際的更新由flush_layout在處理完已
+ * 排隊的事件之後統一進行，從而使一連串的操作只觸發一次布局。 */
 void update_layout(WM *wm)
 {
+    DESKTOP(wm).is_layout_dirty=true;
+    wm->perf_stat.layout_requests++;
+}
+
+void flush_layout(WM *wm)
+{
+    if(!DESKTOP(wm).is_layout_dirty)
+        return;
+    DESKTOP(wm).is_layout_dirty=false;
     if(wm->clients == wm->clients->next)
         return;
 
+    wm->perf_stat.layout_passes++;
     fix_area_type(wm);
     switch(DESKTOP(wm).cur_layout)
     {
@@ -180,32 +190,13 @@ static void fix_cur_focus_client_rect(WM *wm)
 }
 
 
-static void update_title_bar_layout(WM *wm)
-{
-    for(Client *c=wm->clients->next; c!=wm->clients; c=c->next)
-    {
-        if(c->title_bar_h && is_on_cur_desktop(wm, c))
-        {
-            Rect r=get_title_area_rect(wm, c);
-            XResizeWindow(wm->display, c->title_area, r.w, r.h);
-        }
-    }
-}
-
 void update_taskbar_buttons(WM *wm)
 {
-    for(size_t b=TASKBAR_BUTTON_BEGIN; b<TASKBAR_BUTTON_END; b++)
-    {
-        size_t i=TASKBAR_BUTTON_INDEX(b);
-        String_format f={{0, 0, TASKBAR_BUTTON_WIDTH, TASKBAR_BUTTON_HEIGHT},
-                CENTER, true,
-                wm->widget_color[NORMAL_TASKBAR_BUTTON_COLOR].pixel,
-                wm->text_color[TASKBAR_BUTTON_TEXT_COLOR], TASKBAR_BUTTON_FONT};
-        if(b == DESKTOP_BUTTON_BEGIN+wm->cur_desktop-1
-            || (b == LAYOUT_BUTTON_BEGIN+DESKTOP(wm).cur_layout))
-            f.change_bg=true, f.bg=wm->widget_color[CHOSEN_TASKBAR_BUTTON_COLOR].pixel;
-        draw_string(wm, wm->taskbar.buttons[i], TASKBAR_BUTTON_TEXT[i], &f);
-    }
+    Window *wins=wm->taskbar.buttons;
+    for(Widget_type t=TASKBAR_BUTTON_BEGIN; t<=TASKBAR_BUTTON_END; t++)
+        update_label_widget(wm, wins[TASKBAR_BUTTON_INDEX(t)], t,
+            is_chosen_button(wm, t) ? CHOSEN_TASKBAR_BUTTON_COLOR :
+            NORMAL_TASKBAR_BUTTON_COLOR);
 }
 
 bool is_main_sec_gap(WM *wm, int x)
@@ -14,6 +14,7 @@
 
 void change_layout(WM *wm, XEvent *e, Func_arg arg);
 void update_layout(WM *wm);
+void flush_layout(WM *wm);
 void update_taskbar_buttons(WM *wm);
 bool is_main_sec_gap(WM *wm, int x);
 bool is_main_fix_gap(WM *wm, int x);
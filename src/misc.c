@@ -13,10 +13,17 @@
 #include <sys/wait.h>
 #include <dirent.h>
 #include <stdarg.h>
+#include <unistd.h>
 #include "gwm.h"
 #include "client.h"
 #include "font.h"
+#include "grab.h"
+#include "icon_cache.h"
+#include "icon_loader.h"
+#include "icon_theme.h"
 #include "misc.h"
+#include "timer.h"
+#include "watch.h"
 
 static void get_files_in_dir(const char *path, const char *exts[], size_t n, File *head, Order order, bool is_fullname);
 static int str_cmp_basename(const char *s1, const char *s2);
@@ -30,6 +37,14 @@ void *malloc_s(size_t size)
     return p;
 }
 
+void *realloc_s(void *ptr, size_t size)
+{
+    void *p=realloc(ptr, size);
+    if(p == NULL)
+        exit_with_msg("錯誤：申請內存失敗");
+    return p;
+}
+
 int x_fatal_handler(Display *display, XErrorEvent *e)
 {
     unsigned char ec=e->error_code, rc=e->request_code;
@@ -73,64 +88,157 @@ void update_win_background(WM *wm, Window win, unsigned long color, Pixmap pixma
     else
     {
         /* 在調用XSetWindowBackground之後，在收到下一個顯露事件或調用
-         * XClearWindow之前，背景不變。*/
-        XEvent event={.xexpose={.type=Expose, .window=win}};
+         * XClearWindow之前，背景不變。故把窗口加入重繪隊列，由主循環在
+         * 處理完本批事件後統一清除並重繪，而不必給自己發送顯露事件。*/
         XSetWindowBackground(wm->display, win, color);
-        XSendEvent(wm->display, win, False, NoEventMask, &event);
+        add_repaint(wm, win);
+    }
+}
+
+void add_repaint(WM *wm, Window win)
+{
+    XPointer p;
+    if(!XFindContext(wm->display, win, wm->repaint_ctx, &p))
+        return;
+    if(wm->repaint_n == wm->repaint_cap)
+    {
+        wm->repaint_cap = wm->repaint_cap ? wm->repaint_cap*2 : 64;
+        wm->repaints=realloc_s(wm->repaints, wm->repaint_cap*sizeof(Window));
+    }
+    wm->repaints[wm->repaint_n++]=win;
+    XSaveContext(wm->display, win, wm->repaint_ctx, (XPointer)wm);
+}
+
+/* 從重繪隊列中取出窗口並清除其重繪標記，返回false表示隊列已空。已刪除索引
+ * 的窗口可能已被銷毀，故跳過它們。 */
+bool get_repaint(WM *wm, Window *win)
+{
+    XPointer p;
+    while(wm->repaint_n)
+    {
+        *win=wm->repaints[--wm->repaint_n];
+        if(!XFindContext(wm->display, *win, wm->repaint_ctx, &p))
+        {
+            XDeleteContext(wm->display, *win, wm->repaint_ctx);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* 把顯露的矩形r併入窗口win的受損區域 */
+void add_damage(WM *wm, Window win, XRectangle *r)
+{
+    XPointer p;
+    Region damage;
+    if(XFindContext(wm->display, win, wm->damage_ctx, &p))
+    {
+        damage=XCreateRegion();
+        XSaveContext(wm->display, win, wm->damage_ctx, (XPointer)damage);
     }
+    else
+        damage=(Region)p;
+    XUnionRectWithRegion(r, damage, damage);
+}
+
+/* 取出窗口win累積的受損區域，無則返回NULL。調用者應使用XDestroyRegion釋放它 */
+Region take_damage(WM *wm, Window win)
+{
+    XPointer p;
+    if(XFindContext(wm->display, win, wm->damage_ctx, &p))
+        return NULL;
+    XDeleteContext(wm->display, win, wm->damage_ctx);
+    return (Region)p;
+}
+
+/* 判斷矩形是否完全在當前的裁剪區域之外，此時不必繪制它 */
+bool is_clipped_out(WM *wm, int x, int y, unsigned int w, unsigned int h)
+{
+    return wm->draw_clip && XRectInRegion(wm->draw_clip, x, y, w, h)==RectangleOut;
+}
+
+/* 清除窗口win中的矩形區域。重繪受損區域時，只清除它與裁剪區域外接矩形的交集 */
+void clear_area(WM *wm, Window win, int x, int y, unsigned int w, unsigned int h)
+{
+    if(wm->draw_clip)
+    {
+        XRectangle b;
+        XClipBox(wm->draw_clip, &b);
+        int x2=MIN(x+(int)w, b.x+b.width), y2=MIN(y+(int)h, b.y+b.height);
+        x=MAX(x, b.x), y=MAX(y, b.y);
+        if(x>=x2 || y>=y2)
+            return;
+        w=x2-x, h=y2-y;
+    }
+    XClearArea(wm->display, win, x, y, w, h, False);
 }
 
 Pixmap create_pixmap_from_file(WM *wm, Window win, const char *filename)
 {
     unsigned int w, h, d;
+    if(!get_geometry(wm, win, &w, &h, &d))
+        return None;
+
+    /* 加載線程也使用imlib2，持有其鎖時不另外發出X請求，以免讓它等待往返 */
+    lock_imlib();
     Imlib_Image image=imlib_load_image(filename);
-    if(image && get_geometry(wm, win, &w, &h, &d))
-    {
-        Pixmap bg=XCreatePixmap(wm->display, win, w, h, d);
-        imlib_context_set_image(image);
-        imlib_context_set_drawable(bg);   
-        imlib_render_image_on_drawable_at_size(0, 0, w, h);
-        imlib_free_image();
-        return bg;
-    }
-    return None;
+    unlock_imlib();
+    if(!image)
+        return None;
+
+    Pixmap bg=XCreatePixmap(wm->display, win, w, h, d);
+    lock_imlib();
+    imlib_context_set_image(image);
+    imlib_context_set_drawable(bg);   
+    imlib_render_image_on_drawable_at_size(0, 0, w, h);
+    imlib_free_image();
+    unlock_imlib();
+    return bg;
 }
 
 Widget_type get_widget_type(WM *wm, Window win)
 {
     Widget_type type;
-    Client *c;
-    if(win == wm->root_win)
-        return ROOT_WIN;
-    if(win == wm->run_cmd.win)
-        return RUN_CMD_ENTRY;
-    if(win == wm->hint_win)
-        return HINT_WIN;
-    for(type=TASKBAR_BUTTON_BEGIN; type<=TASKBAR_BUTTON_END; type++)
-        if(win == wm->taskbar.buttons[TASKBAR_BUTTON_INDEX(type)])
-            return type;
-    if(win == wm->taskbar.status_area)
-        return STATUS_AREA;
-    for(Client *c=wm->clients->next; c!=wm->clients; c=c->next)
-        if(c->area_type==ICONIFY_AREA && win==c->icon->win)
-            return CLIENT_ICON;
-    for(type=CMD_CENTER_ITEM_BEGIN; type<=CMD_CENTER_ITEM_END; type++)
-        if(win == wm->cmd_center.items[CMD_CENTER_ITEM_INDEX(type)])
-            return type;
-    if((c=win_to_client(wm, win)))
+    return find_win_index(wm, win, NULL, &type) ? type : UNDEFINED;
+}
+
+/* 窗口管理器自己創建或管理的窗口都要在創建時登記其所屬的客戶窗口（不屬於客
+ * 戶窗口時爲NULL）和構件類型，在銷毀前註銷。由此，從窗口ID查找客戶窗口和構
+ * 件類型時，就不必遍歷客戶窗口鏈表了。*/
+void set_win_index(WM *wm, Window win, Client *c, Widget_type type)
+{
+    if(win)
+    {
+        XSaveContext(wm->display, win, wm->client_ctx, (XPointer)c);
+        XSaveContext(wm->display, win, wm->widget_ctx, (XPointer)(intptr_t)type);
+    }
+}
+
+void del_win_index(WM *wm, Window win)
+{
+    if(win)
     {
-        if(win == c->win)
-            return CLIENT_WIN;
-        else if(win == c->frame)
-            return CLIENT_FRAME;
-        else if(win == c->title_area)
-            return TITLE_AREA;
-        else
-            for(type=TITLE_BUTTON_BEGIN; type<=TITLE_BUTTON_END; type++)
-                if(win == c->buttons[TITLE_BUTTON_INDEX(type)])
-                    return type;
+        XDeleteContext(wm->display, win, wm->client_ctx);
+        XDeleteContext(wm->display, win, wm->widget_ctx);
+        XDeleteContext(wm->display, win, wm->repaint_ctx);
+        Region damage=take_damage(wm, win);
+        if(damage)
+            XDestroyRegion(damage);
     }
-    return UNDEFINED;
+}
+
+bool find_win_index(WM *wm, Window win, Client **c, Widget_type *type)
+{
+    XPointer pc, pt;
+    // 當隱藏標題欄時，標題區和按鈕的窗口ID爲0。故win爲0時，不應視爲找到
+    if( !win || XFindContext(wm->display, win, wm->client_ctx, &pc)
+        || XFindContext(wm->display, win, wm->widget_ctx, &pt))
+        return false;
+    if(c)
+        *c=(Client *)pc;
+    if(type)
+        *type=(Widget_type)(intptr_t)pt;
+    return true;
 }
 
 Pointer_act get_resize_act(Client *c, const Move_info *m)
@@ -171,6 +279,45 @@ bool is_chosen_button(WM *wm, Widget_type type)
         || type == LAYOUT_BUTTON_BEGIN+DESKTOP(wm).cur_layout);
 }
 
+/* 返回靜態標籤構件type以color爲背景色時的標籤像素圖，非此類構件則返回None */
+Pixmap get_widget_label_pixmap(WM *wm, Widget_type type, Widget_color color)
+{
+    unsigned long bg=wm->widget_color[color].pixel;
+    String_format f;
+    const char *text;
+    if(IS_TASKBAR_BUTTON(type))
+    {
+        text=TASKBAR_BUTTON_TEXT[TASKBAR_BUTTON_INDEX(type)];
+        f=(String_format){{0, 0, TASKBAR_BUTTON_WIDTH, TASKBAR_BUTTON_HEIGHT},
+            CENTER, true, bg, wm->text_color[TASKBAR_BUTTON_TEXT_COLOR],
+            TASKBAR_BUTTON_FONT};
+    }
+    else if(IS_CMD_CENTER_ITEM(type))
+    {
+        text=CMD_CENTER_ITEM_TEXT[CMD_CENTER_ITEM_INDEX(type)];
+        f=(String_format){{0, 0, CMD_CENTER_ITEM_WIDTH, CMD_CENTER_ITEM_HEIGHT},
+            CENTER_LEFT, true, bg, wm->text_color[CMD_CENTER_ITEM_TEXT_COLOR],
+            CMD_CENTER_FONT};
+    }
+    else if(IS_TITLE_BUTTON(type))
+    {
+        text=TITLE_BUTTON_TEXT[TITLE_BUTTON_INDEX(type)];
+        f=(String_format){{0, 0, TITLE_BUTTON_WIDTH, TITLE_BUTTON_HEIGHT},
+            CENTER, true, bg, wm->text_color[TITLE_BUTTON_TEXT_COLOR],
+            TITLE_BUTTON_FONT};
+    }
+    else
+        return None;
+    return get_label_pixmap(wm, text, &f);
+}
+
+/* 靜態標籤構件的文字在運行時不變，改變其背景色時只需更換背景像素圖，由X
+ * 服務器自行重繪，因而它們不必選擇顯露事件 */
+void update_label_widget(WM *wm, Window win, Widget_type type, Widget_color color)
+{
+    update_win_background(wm, win, 0, get_widget_label_pixmap(wm, type, color));
+}
+
 void set_xic(WM *wm, Window win, XIC *ic)
 {
     if(wm->xim == NULL)
@@ -202,25 +349,27 @@ KeySym look_up_key(XIC xic, XKeyEvent *e, wchar_t *keyname, size_t n)
     return ks;
 }
 
-Atom get_atom_prop(WM *wm, Window win, Atom prop)
-{
-    unsigned char *p=get_prop(wm, win, prop, NULL);
-    return p ? *(Atom *)p : None;
-}
-
 /* 調用此函數時需要注意：若返回的特性數據的實際格式是32位的話，
  * 則特性數據存儲於long型數組中。當long是64位時，前4字節會會填充0。 */
 unsigned char *get_prop(WM *wm, Window win, Atom prop, unsigned long *n)
+{
+    /* 对于XGetWindowProperty，把要接收的数据长度（第5个参数）设置得比实际长度
+     * 長可简化代码，这样就不必考虑要接收的數據是否不足32位。以下同理。 */
+    return get_prop_range(wm, win, prop, 0, ~0L, n, NULL);
+}
+
+/* 只讀取特性數據中從第offset個32位單元開始的len個32位單元，n非空時返回實際
+ * 讀取的項數，rest非空時返回其後剩餘的字節數。其餘注意事項同get_prop。 */
+unsigned char *get_prop_range(WM *wm, Window win, Atom prop, long offset, long len, unsigned long *n, unsigned long *rest)
 {
     int fmt;
-    unsigned long nitems, rest;
+    unsigned long nitems, bytes_after;
     unsigned char *p=NULL;
     Atom type;
 
-    /* 对于XGetWindowProperty，把要接收的数据长度（第5个参数）设置得比实际长度
-     * 長可简化代码，这样就不必考虑要接收的數據是否不足32位。以下同理。 */
-    if( XGetWindowProperty(wm->display, win, prop, 0, ~0L, False,
-        AnyPropertyType, &type, &fmt, n ? n : &nitems, &rest, &p)==Success && p)
+    if( XGetWindowProperty(wm->display, win, prop, offset, len, False,
+        AnyPropertyType, &type, &fmt, n ? n : &nitems,
+        rest ? rest : &bytes_after, &p)==Success && p)
         return p;
     return NULL;
 }
@@ -233,6 +382,9 @@ void set_override_redirect(WM *wm, Window win)
 
 void clear_wm(WM *wm)
 {
+#if SHOW_PERF_STAT
+    print_perf_stat(wm);
+#endif
     for(Client *c=wm->clients->next; c!=wm->clients; c=c->next)
     {
         XReparentWindow(wm->display, c->win, wm->root_win, c->x, c->y);
@@ -244,18 +396,44 @@ void clear_wm(WM *wm)
     XDestroyWindow(wm->display, wm->run_cmd.win);
     XDestroyWindow(wm->display, wm->hint_win);
     XFreeModifiermap(wm->mod_map);
+    clear_bind_index(wm);
+#if USE_IMAGE_ICON
+    clear_icon_loader(wm); // 須先於clear_icon_themes，因加載線程會搜索主題
+    clear_icon_themes();
+    close_icon_cache();
+#endif
+    clear_watches(wm); // 須後於clear_icon_loader，因加載線程會添加監視
+#ifdef WALLPAPER_PATHS
+    free_files(wm->wallpapers);
+#endif
+    free(wm->repaints);
     for(size_t i=0; i<POINTER_ACT_N; i++)
         XFreeCursor(wm->display, wm->cursors[i]);
     XSetInputFocus(wm->display, wm->root_win, RevertToPointerRoot, CurrentTime);
     XDestroyIC(wm->run_cmd.xic);
     XCloseIM(wm->xim);
     close_fonts(wm);
+    clear_timers(wm);
+    if(wm->signal_fd != -1)
+        close(wm->signal_fd);
     XClearWindow(wm->display, wm->root_win);
     XFlush(wm->display);
     XCloseDisplay(wm->display);
     clear_zombies(0);
 }
 
+void print_perf_stat(WM *wm)
+{
+    Perf_stat *p=&wm->perf_stat;
+    fprintf(stderr, "性能統計：\n");
+    fprintf(stderr, "    合併的定位器移動事件數：%lu\n", p->coalesced_motions);
+    fprintf(stderr, "    請求／實際更新布局次數：%lu／%lu\n",
+        p->layout_requests, p->layout_passes);
+    fprintf(stderr, "    省去的窗口配置請求數：%lu\n", p->skipped_geometry_requests);
+    fprintf(stderr, "    文本寬度緩存命中／未命中次數：%lu／%lu\n",
+        p->text_extent_hits, p->text_extent_misses);
+}
+
 bool get_geometry(WM *wm, Drawable drw, unsigned int *w, unsigned int *h, unsigned int *depth)
 {
     Window r;
@@ -264,6 +442,15 @@ bool get_geometry(WM *wm, Drawable drw, unsigned int *w, unsigned int *h, unsign
     return XGetGeometry(wm->display, drw, &r, &xt, &yt, w, h, &bw, depth);
 }
 
+/* FNV-1a字符串散列函數 */
+unsigned long get_string_hash(const char *s)
+{
+    uint32_t h=2166136261U;
+    for(const unsigned char *p=(const unsigned char *)s; *p; p++)
+        h=(h^*p)*16777619U;
+    return h;
+}
+
 char *copy_string(const char *s)
 {
     return strcpy(malloc_s(strlen(s)+1), s);
@@ -371,3 +558,9 @@ static void create_file_node(File *head, const char *path, char *filename, bool
     file->next=head->next;
     head->next=file;
 }
+
+void free_files(File *head)
+{
+    for(File *f=head, *next=NULL; f; f=next)
+        next=f->next, free(f->name), free(f);
+}
@@ -13,28 +13,43 @@
 #define MISC_H
 
 void *malloc_s(size_t size);
+void *realloc_s(void *ptr, size_t size);
 int x_fatal_handler(Display *display, XErrorEvent *e);
 void exit_with_perror(const char *s);
 void exit_with_msg(const char *msg);
 bool is_wm_win(WM *wm, Window win);
 void update_win_background(WM *wm, Window win, unsigned long color, Pixmap pixmap);
+void add_repaint(WM *wm, Window win);
+bool get_repaint(WM *wm, Window *win);
+void add_damage(WM *wm, Window win, XRectangle *r);
+Region take_damage(WM *wm, Window win);
+bool is_clipped_out(WM *wm, int x, int y, unsigned int w, unsigned int h);
+void clear_area(WM *wm, Window win, int x, int y, unsigned int w, unsigned int h);
 Pixmap create_pixmap_from_file(WM *wm, Window win, const char *filename);
 Widget_type get_widget_type(WM *wm, Window win);
+void set_win_index(WM *wm, Window win, Client *c, Widget_type type);
+void del_win_index(WM *wm, Window win);
+bool find_win_index(WM *wm, Window win, Client **c, Widget_type *type);
 Pointer_act get_resize_act(Client *c, const Move_info *m);
 void clear_zombies(int unused);
+void print_perf_stat(WM *wm);
 bool is_chosen_button(WM *wm, Widget_type type);
+Pixmap get_widget_label_pixmap(WM *wm, Widget_type type, Widget_color color);
+void update_label_widget(WM *wm, Window win, Widget_type type, Widget_color color);
 void set_xic(WM *wm, Window win, XIC *ic);
 Window get_transient_for(WM *wm, Window w);
 KeySym look_up_key(XIC xic, XKeyEvent *e, wchar_t *keyname, size_t n);
-Atom get_atom_prop(WM *wm, Window win, Atom prop);
 unsigned char *get_prop(WM *wm, Window win, Atom prop, unsigned long *n);
+unsigned char *get_prop_range(WM *wm, Window win, Atom prop, long offset, long len, unsigned long *n, unsigned long *rest);
 void set_override_redirect(WM *wm, Window win);
 void clear_wm(WM *wm);
 bool get_geometry(WM *wm, Drawable drw, unsigned int *w, unsigned int *h, unsigned int *depth);
+unsigned long get_string_hash(const char *s);
 char *copy_string(const char *s);
 char *copy_strings(const char *s, ...);
 void set_pos_for_click(WM *wm, Window click, int cx, int cy, int *px, int *py, unsigned int pw, unsigned int ph);
 bool is_win_exist(WM *wm, Window win, Window parent);
 File *get_files_in_dirs(const char *paths[], size_t n, const char *exts[], size_t m, Order order, bool is_fullname);
+void free_files(File *head);
 
 #endif
@@ -0,0 +1,163 @@
+/* *************************************************************************
+ *     prop.c：實現通過XCB成批讀取窗口特性的功能。
+ *     版權 (C) 2020-2022 gsm <406643764@qq.com>
+ *     本程序為自由軟件：你可以依據自由軟件基金會所發布的第三版或更高版本的
+ * GNU通用公共許可證重新發布、修改本程序。
+ *     雖然基于使用目的而發布本程序，但不負任何擔保責任，亦不包含適銷性或特
+ * 定目標之適用性的暗示性擔保。詳見GNU通用公共許可證。
+ *     你應該已經收到一份附隨此程序的GNU通用公共許可證副本。否則，請參閱
+ * <http://www.gnu.org/licenses/>。
+ * ************************************************************************/
+
+#include <X11/Xlib-xcb.h>
+#include "gwm.h"
+#include "font.h"
+#include "misc.h"
+#include "prop.h"
+
+/* 添加客戶窗口時要讀取十來項窗口特性。用Xlib逐項讀取時每項都要等待一次往返，
+ * X服務器繁忙時新窗口要等好幾毫秒才能框起來。XCB的請求和應答是分離的，故先
+ * 一次發出所有請求，再依次收取應答，總共只需等待約一次往返。Xlib與XCB共用
+ * 同一連接，XCB發送請求前會先送出Xlib緩衝的請求，故兩者的請求次序不會錯亂。
+ * 從應答中解析特性的方式與相應的Xlib函數一致。 */
+
+#define SIZE_HINTS_MIN_N 15 // 舊版WM_NORMAL_HINTS的項數，沒有基本尺寸和重力
+#define SIZE_HINTS_N 18 // WM_NORMAL_HINTS的項數
+#define WM_HINTS_MIN_N 8 // 舊版WM_HINTS的項數，沒有窗口組
+#define WM_HINTS_N 9 // WM_HINTS的項數
+
+enum prop_index_tag // 成批讀取的特性在請求數組中的下標
+{
+    TRANSIENT_FOR_PROP, NAME_PROP, NORMAL_HINTS_PROP, TYPE_PROP, STATE_PROP,
+    CLASS_PROP, HINTS_PROP, PROP_N
+};
+
+static void set_client_prop(WM *wm, Client_props *p, size_t index, xcb_get_property_reply_t *r);
+static char *get_string_value(xcb_get_property_reply_t *r);
+static void set_size_hint_value(XSizeHints *hint, const uint32_t *v, uint32_t n);
+static void set_class_hint_value(XClassHint *hint, xcb_get_property_reply_t *r);
+static XWMHints *get_wm_hint_value(const uint32_t *v, uint32_t n);
+
+/* 讀取添加客戶窗口所需的窗口特性。窗口可能已經銷毀，此時相應特性取缺省值。
+ * 返回的字符串和wm_hint由調用者釋放。 */
+void get_client_props(WM *wm, Window win, Client_props *props)
+{
+    xcb_connection_t *conn=XGetXCBConnection(wm->display);
+    Atom atoms[PROP_N]={XA_WM_TRANSIENT_FOR, XA_WM_NAME, XA_WM_NORMAL_HINTS,
+        wm->ewmh_atom[_NET_WM_WINDOW_TYPE], wm->ewmh_atom[_NET_WM_STATE],
+        XA_WM_CLASS, XA_WM_HINTS};
+    xcb_get_property_cookie_t cookies[PROP_N];
+    xcb_generic_error_t *err=NULL;
+
+    for(size_t i=0; i<PROP_N; i++)
+        cookies[i]=xcb_get_property(conn, 0, win, atoms[i],
+            XCB_GET_PROPERTY_TYPE_ANY, 0, UINT32_MAX);
+    xcb_get_geometry_cookie_t gc=xcb_get_geometry(conn, win);
+
+    memset(props, 0, sizeof(Client_props));
+    props->attr.width=wm->screen_width/4, props->attr.height=wm->screen_height/4;
+    for(size_t i=0; i<PROP_N; i++)
+    {
+        xcb_get_property_reply_t *r=xcb_get_property_reply(conn, cookies[i], &err);
+        if(r && r->type!=XCB_NONE)
+            set_client_prop(wm, props, i, r);
+        free(r), free(err), err=NULL;
+    }
+    xcb_get_geometry_reply_t *g=xcb_get_geometry_reply(conn, gc, &err);
+    if(g)
+    {
+        props->attr.x=g->x, props->attr.y=g->y;
+        props->attr.width=g->width, props->attr.height=g->height;
+    }
+    free(g), free(err);
+    if(!props->title_text)
+        props->title_text=copy_string("");
+}
+
+static void set_client_prop(WM *wm, Client_props *p, size_t index, xcb_get_property_reply_t *r)
+{
+    const uint32_t *v=xcb_get_property_value(r);
+    uint32_t n=xcb_get_property_value_length(r)/4;
+    bool is_card32=r->format==32 && n;
+
+    switch(index)
+    {
+        case TRANSIENT_FOR_PROP:
+            if(r->type==XA_WINDOW && is_card32)
+                p->owner=v[0];
+            break;
+        case NAME_PROP:
+        {
+            XTextProperty t={NULL, r->type, r->format, r->value_len};
+            if((t.value=(unsigned char *)get_string_value(r)))
+                p->title_text=get_text_prop_string(wm, &t), free(t.value);
+            break;
+        }
+        case NORMAL_HINTS_PROP:
+            if((p->has_size_hint=r->type==XA_WM_SIZE_HINTS
+                && r->format==32 && n>=SIZE_HINTS_MIN_N))
+                set_size_hint_value(&p->size_hint, v, n);
+            break;
+        case TYPE_PROP:
+            p->type = is_card32 ? v[0] : None; break;
+        case STATE_PROP:
+            p->state = is_card32 ? v[0] : None; break;
+        case CLASS_PROP:
+            if((p->has_class_hint=r->type==XA_STRING && r->format==8))
+                set_class_hint_value(&p->class_hint, r);
+            break;
+        case HINTS_PROP:
+            if(r->type==XA_WM_HINTS && r->format==32 && n>=WM_HINTS_MIN_N)
+                p->wm_hint=get_wm_hint_value(v, n);
+            break;
+    }
+}
+
+/* 返回以空字符結尾的特性數據副本 */
+static char *get_string_value(xcb_get_property_reply_t *r)
+{
+    int n=xcb_get_property_value_length(r);
+    char *s=malloc_s(n+1);
+    memcpy(s, xcb_get_property_value(r), n);
+    s[n]='\0';
+    return s;
+}
+
+/* 同XGetWMNormalHints，把各項CARD32轉換爲XSizeHints */
+static void set_size_hint_value(XSizeHints *hint, const uint32_t *v, uint32_t n)
+{
+    const int32_t *iv=(const int32_t *)v;
+    *hint=(XSizeHints){.flags=v[0]&(USPosition|USSize|PAllHints),
+        .x=iv[1], .y=iv[2], .width=iv[3], .height=iv[4],
+        .min_width=iv[5], .min_height=iv[6], .max_width=iv[7], .max_height=iv[8],
+        .width_inc=iv[9], .height_inc=iv[10],
+        .min_aspect={iv[11], iv[12]}, .max_aspect={iv[13], iv[14]}};
+    if(n >= SIZE_HINTS_N)
+    {
+        hint->flags |= v[0]&(PBaseSize|PWinGravity);
+        hint->base_width=iv[15], hint->base_height=iv[16], hint->win_gravity=iv[17];
+    }
+}
+
+/* 同XGetClassHint，特性數據依次爲以空字符分隔的res_name和res_class */
+static void set_class_hint_value(XClassHint *hint, xcb_get_property_reply_t *r)
+{
+    char *s=get_string_value(r);
+    size_t n=xcb_get_property_value_length(r), len=strlen(s);
+    hint->res_name=copy_string(s);
+    hint->res_class=copy_string(len<n ? s+len+1 : s+n);
+    free(s);
+}
+
+/* 同XGetWMHints，把各項CARD32轉換爲XWMHints */
+static XWMHints *get_wm_hint_value(const uint32_t *v, uint32_t n)
+{
+    XWMHints *hint=XAllocWMHints();
+    if(!hint)
+        return NULL;
+    *hint=(XWMHints){.flags=v[0], .input=v[1], .initial_state=v[2],
+        .icon_pixmap=v[3], .icon_window=v[4], .icon_x=(int32_t)v[5],
+        .icon_y=(int32_t)v[6], .icon_mask=v[7],
+        .window_group = n>=WM_HINTS_N ? v[8] : None};
+    return hint;
+}
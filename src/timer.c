@@ -0,0 +1,123 @@
+/* *************************************************************************
+ *     timer.c：實現定時器功能。
+ *     版權 (C) 2020-2022 gsm <406643764@qq.com>
+ *     本程序為自由軟件：你可以依據自由軟件基金會所發布的第三版或更高版本的
+ * GNU通用公共許可證重新發布、修改本程序。
+ *     雖然基于使用目的而發布本程序，但不負任何擔保責任，亦不包含適銷性或特
+ * 定目標之適用性的暗示性擔保。詳見GNU通用公共許可證。
+ *     你應該已經收到一份附隨此程序的GNU通用公共許可證副本。否則，請參閱
+ * <http://www.gnu.org/licenses/>。
+ * ************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L // 爲了使用clock_gettime
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "gwm.h"
+#include "timer.h"
+#include "misc.h"
+
+static void arm_timer_fd(WM *wm);
+static bool is_before(const struct timespec *a, const struct timespec *b);
+
+/* 所有定時器共用一個timerfd，它總是按鏈表頭（即最早到期）的定時器設置，
+ * 主循環用poll等待它可讀即可。定時器數量很少，故用有序鏈表就夠了。 */
+void init_timers(WM *wm)
+{
+    wm->timers=NULL;
+    if((wm->timer_fd=timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) == -1)
+        exit_with_perror("不能創建timerfd");
+}
+
+void clear_timers(WM *wm)
+{
+    for(Timer *t=wm->timers, *next=NULL; t; t=next)
+        next=t->next, free(t);
+    wm->timers=NULL;
+    close(wm->timer_fd);
+}
+
+/* 添加ms毫秒後到期的一次性定時器。到期後定時器會被自動釋放，因而func
+ * 應該丟棄它所持有的該定時器指針。 */
+Timer *add_timer(WM *wm, long ms, void (*func)(WM *, void *), void *arg)
+{
+    Timer *t=malloc_s(sizeof(Timer)), **pp=&wm->timers;
+    clock_gettime(CLOCK_MONOTONIC, &t->deadline);
+    ms=MAX(ms, 0);
+    t->deadline.tv_sec+=ms/1000;
+    t->deadline.tv_nsec+=ms%1000*1000000L;
+    if(t->deadline.tv_nsec >= 1000000000L)
+        t->deadline.tv_sec++, t->deadline.tv_nsec-=1000000000L;
+    t->func=func, t->arg=arg;
+
+    while(*pp && !is_before(&t->deadline, &(*pp)->deadline))
+        pp=&(*pp)->next;
+    t->next=*pp, *pp=t;
+    if(t == wm->timers)
+        arm_timer_fd(wm);
+    return t;
+}
+
+void del_timer(WM *wm, Timer *timer)
+{
+    for(Timer **pp=&wm->timers; *pp; pp=&(*pp)->next)
+    {
+        if(*pp == timer)
+        {
+            bool is_head=(pp == &wm->timers);
+            *pp=timer->next;
+            free(timer);
+            if(is_head)
+                arm_timer_fd(wm);
+            return;
+        }
+    }
+}
+
+/* 調用所有已到期的定時器函數。在調用前先把定時器移出鏈表，因此定時器
+ * 函數可以放心地添加或刪除其他定時器。 */
+void run_timers(WM *wm)
+{
+    struct timespec now;
+    Timer *t;
+
+    if(!wm->timers)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    while((t=wm->timers) && !is_before(&now, &t->deadline))
+    {
+        wm->timers=t->next;
+        t->func(wm, t->arg);
+        free(t);
+    }
+    arm_timer_fd(wm);
+}
+
+/* 返回從from開始計時ms毫秒後的時刻與現在相差的毫秒數，向上取整，已過時返回0 */
+long get_remaining_ms(const struct timespec *from, long ms)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long ns=(from->tv_sec-now.tv_sec)*1000000000LL
+        +(from->tv_nsec-now.tv_nsec)+ms*1000000LL;
+    return ns>0 ? (ns+999999)/1000000 : 0;
+}
+
+/* 重新設置timerfd亦會清除其已到期次數，故無需read它 */
+static void arm_timer_fd(WM *wm)
+{
+    struct itimerspec its={{0, 0}, {0, 0}};
+    if(wm->timers)
+    {
+        its.it_value=wm->timers->deadline;
+        if(!its.it_value.tv_sec && !its.it_value.tv_nsec)
+            its.it_value.tv_nsec=1; // 全零會解除定時
+    }
+    if(timerfd_settime(wm->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+        perror("不能設置timerfd");
+}
+
+static bool is_before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec<b->tv_sec || (a->tv_sec==b->tv_sec && a->tv_nsec<b->tv_nsec);
+}
@@ -0,0 +1,239 @@
+/* *************************************************************************
+ *     watch.c：實現以inotify監視壁紙目錄和圖標主題目錄的功能。
+ *     版權 (C) 2020-2022 gsm <406643764@qq.com>
+ *     本程序為自由軟件：你可以依據自由軟件基金會所發布的第三版或更高版本的
+ * GNU通用公共許可證重新發布、修改本程序。
+ *     雖然基于使用目的而發布本程序，但不負任何擔保責任，亦不包含適銷性或特
+ * 定目標之適用性的暗示性擔保。詳見GNU通用公共許可證。
+ *     你應該已經收到一份附隨此程序的GNU通用公共許可證副本。否則，請參閱
+ * <http://www.gnu.org/licenses/>。
+ * ************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L // 爲了使用lstat
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gwm.h"
+#include "icon.h"
+#include "icon_loader.h"
+#include "misc.h"
+#include "watch.h"
+
+/* 所有目錄共用一個inotify實例，主循環用poll等待它可讀。壁紙列表在主循環中
+ * 增量更新；圖標主題數據只由加載線程訪問，故轉交加載線程更新。加載線程在列出
+ * 目錄時也會添加監視，故監視鏈表須加鎖。只關心文件的增刪及改寫，目錄中沒有
+ * 變化時完全不必重新掃描。 */
+
+#define WATCH_MASK (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_CLOSE_WRITE|IN_ONLYDIR)
+#define WATCH_ADD_MASK (IN_MOVED_TO|IN_CLOSE_WRITE) // 表示文件已寫完或移入的事件
+#define WATCH_BUF_SIZE 4096 // 讀取事件的緩衝區大小
+
+struct watch_tag // 被監視的目錄
+{
+    int wd; // 監視描述符
+    Watch_type type; // 目錄類型
+    char *path; // 目錄名
+    struct watch_tag *next;
+};
+typedef struct watch_tag Watch;
+
+static pthread_mutex_t watch_mutex=PTHREAD_MUTEX_INITIALIZER; // 保護watches
+static Watch *watches=NULL;
+static int watch_fd=-1;
+
+static bool get_watch(int wd, Watch_type *type, char **path);
+static void del_watch(int wd);
+static void handle_watch_event(WM *wm, const struct inotify_event *e);
+static bool is_created_entry(const char *dir, const struct inotify_event *e);
+#ifdef WALLPAPER_PATHS
+static void update_wallpaper_files(WM *wm, const char *dir, const char *file, bool is_added);
+static void reset_wallpaper_files(WM *wm);
+#endif
+
+/* 不能創建inotify實例時不影響其他功能，只是不能自動發現文件變化 */
+void init_watches(WM *wm)
+{
+    if((watch_fd=inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) == -1)
+        perror("不能創建inotify實例");
+    wm->watch_fd=watch_fd;
+#ifdef WALLPAPER_PATHS
+    for(size_t i=0; i<ARRAY_NUM(WALLPAPER_PATHS); i++)
+        add_watch(WALLPAPER_PATHS[i], WALLPAPER_WATCH);
+#endif
+}
+
+void clear_watches(WM *wm)
+{
+    pthread_mutex_lock(&watch_mutex);
+    for(Watch *w=watches, *next=NULL; w; w=next)
+        next=w->next, free(w->path), free(w);
+    watches=NULL;
+    if(watch_fd != -1)
+        close(watch_fd);
+    wm->watch_fd=watch_fd=-1;
+    pthread_mutex_unlock(&watch_mutex);
+}
+
+/* 監視目錄path，已監視或目錄不存在時忽略。可在加載線程中調用。 */
+void add_watch(const char *path, Watch_type type)
+{
+    pthread_mutex_lock(&watch_mutex);
+    Watch *w=watches;
+    while(w && strcmp(w->path, path))
+        w=w->next;
+    int wd = watch_fd==-1 || w ? -1 : inotify_add_watch(watch_fd, path, WATCH_MASK);
+    // 同一目錄經由不同路徑（如符號鏈接）監視時，得到的是同一個監視描述符
+    for(w=watches; wd!=-1 && w && w->wd!=wd; w=w->next)
+        ;
+    if(wd!=-1 && !w)
+    {
+        w=malloc_s(sizeof(Watch));
+        *w=(Watch){wd, type, copy_string(path), watches};
+        watches=w;
+    }
+    pthread_mutex_unlock(&watch_mutex);
+}
+
+void handle_watch_events(WM *wm)
+{
+    _Alignas(struct inotify_event) char buf[WATCH_BUF_SIZE];
+    ssize_t n;
+
+    while((n=read(watch_fd, buf, sizeof(buf))) > 0)
+    {
+        for(char *p=buf; p<buf+n; )
+        {
+            const struct inotify_event *e=(const struct inotify_event *)p;
+            handle_watch_event(wm, e);
+            p+=sizeof(struct inotify_event)+e->len;
+        }
+    }
+    if(n==-1 && errno!=EAGAIN)
+        perror("不能讀取inotify事件");
+}
+
+static void handle_watch_event(WM *wm, const struct inotify_event *e)
+{
+    Watch_type type;
+    char *dir=NULL;
+    bool is_added=e->mask&WATCH_ADD_MASK;
+
+    if(e->mask & IN_Q_OVERFLOW) // 事件隊列溢出，丟失了事件，只能全部重建
+    {
+#ifdef WALLPAPER_PATHS
+        reset_wallpaper_files(wm);
+#endif
+#if USE_IMAGE_ICON
+        request_icon_theme_update(NULL, NULL, false);
+        reload_icon_images(wm, NULL);
+#endif
+    }
+    else if(e->mask & IN_IGNORED) // 目錄已刪除或已不能監視
+        del_watch(e->wd);
+    else if(e->len && get_watch(e->wd, &type, &dir))
+    {
+        if((e->mask & IN_CREATE) && !(is_added=is_created_entry(dir, e)))
+        {
+            free(dir);
+            return;
+        }
+#ifdef WALLPAPER_PATHS
+        if(type == WALLPAPER_WATCH)
+            update_wallpaper_files(wm, dir, e->name, is_added);
+#endif
+#if USE_IMAGE_ICON
+        if(type == ICON_THEME_WATCH)
+        {
+            request_icon_theme_update(dir, e->name, is_added);
+            if(is_added)
+                reload_icon_images(wm, e->name);
+        }
+#endif
+        free(dir);
+    }
+}
+
+/* 普通文件創建時可能尚未寫入數據，待IN_CLOSE_WRITE時才算新增。目錄、符號
+ * 鏈接和硬鏈接創建後不會再有IN_CLOSE_WRITE，故創建時即算新增。 */
+static bool is_created_entry(const char *dir, const struct inotify_event *e)
+{
+    struct stat st;
+    if(e->mask & IN_ISDIR)
+        return true;
+    char *path=copy_strings(dir, "/", e->name, NULL);
+    bool result=!lstat(path, &st) && (S_ISLNK(st.st_mode) || st.st_nlink>1);
+    free(path);
+    return result;
+}
+
+/* 找到時由path返回目錄名的副本，由調用者釋放 */
+static bool get_watch(int wd, Watch_type *type, char **path)
+{
+    pthread_mutex_lock(&watch_mutex);
+    Watch *w=watches;
+    while(w && w->wd!=wd)
+        w=w->next;
+    if(w)
+        *type=w->type, *path=copy_string(w->path);
+    pthread_mutex_unlock(&watch_mutex);
+    return w;
+}
+
+static void del_watch(int wd)
+{
+    pthread_mutex_lock(&watch_mutex);
+    for(Watch **pp=&watches, *w=NULL; (w=*pp); pp=&w->next)
+    {
+        if(w->wd == wd)
+        {
+            *pp=w->next, free(w->path), free(w);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&watch_mutex);
+}
+
+#ifdef WALLPAPER_PATHS
+/* 新增的壁紙插在列表開頭；刪除的若是當前壁紙，則讓其前一個成爲當前壁紙，
+ * 以便下次切換到其後一個 */
+static void update_wallpaper_files(WM *wm, const char *dir, const char *file, bool is_added)
+{
+    const char *ext=strrchr(file, '.');
+    size_t i=0, n=ARRAY_NUM(WALLPAPER_EXTS);
+    while(ext && i<n && strcmp(ext+1, WALLPAPER_EXTS[i]))
+        i++;
+    if(!ext || i==n)
+        return;
+
+    char *filename=copy_strings(dir, "/", file, NULL);
+    File *f=wm->wallpapers;
+    while(f->next && strcmp(f->next->name, filename))
+        f=f->next;
+    if(is_added && !f->next)
+    {
+        File *p=malloc_s(sizeof(File));
+        p->name=filename, filename=NULL;
+        p->next=wm->wallpapers->next, wm->wallpapers->next=p;
+    }
+    else if(!is_added && f->next)
+    {
+        File *p=f->next;
+        if(p == wm->cur_wallpaper)
+            wm->cur_wallpaper = f==wm->wallpapers ? NULL : f;
+        f->next=p->next;
+        free(p->name), free(p);
+    }
+    free(filename);
+}
+
+static void reset_wallpaper_files(WM *wm)
+{
+    free_files(wm->wallpapers);
+    wm->wallpapers=get_files_in_dirs(WALLPAPER_PATHS, ARRAY_NUM(WALLPAPER_PATHS),
+        WALLPAPER_EXTS, ARRAY_NUM(WALLPAPER_EXTS), NOSORT, true);
+    wm->cur_wallpaper=NULL;
+}
+#endif